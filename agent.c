@@ -0,0 +1,242 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "agent.h"
+
+#define AX_ADD		0x02
+#define AX_SUB		0x03
+#define AX_MUL		0x04
+#define AX_DIV_SIGNED	0x05
+#define AX_DIV_UNSIGNED	0x06
+#define AX_REM_SIGNED	0x07
+#define AX_REM_UNSIGNED	0x08
+#define AX_LSH		0x09
+#define AX_RSH_SIGNED	0x0a
+#define AX_RSH_UNSIGNED	0x0b
+#define AX_LOG_NOT	0x0e
+#define AX_BIT_AND	0x0f
+#define AX_BIT_OR	0x10
+#define AX_BIT_XOR	0x11
+#define AX_BIT_NOT	0x12
+#define AX_EQUAL	0x13
+#define AX_LESS_SIGNED	0x14
+#define AX_LESS_UNSIGNED 0x15
+#define AX_EXT		0x16
+#define AX_REF8		0x17
+#define AX_REF16	0x18
+#define AX_REF32	0x19
+#define AX_REF64	0x1a
+#define AX_IF_GOTO	0x20
+#define AX_GOTO		0x21
+#define AX_CONST8	0x22
+#define AX_CONST16	0x23
+#define AX_CONST32	0x24
+#define AX_CONST64	0x25
+#define AX_REG		0x26
+#define AX_END		0x27
+#define AX_DUP		0x28
+#define AX_POP		0x29
+#define AX_ZERO_EXT	0x2a
+#define AX_SWAP		0x2b
+#define AX_PICK		0x32
+#define AX_ROT		0x33
+
+static u64 ref(u64 addr, u32 size)
+{
+	u8 p[8];
+	u64 v;
+	u32 i;
+
+	// wraps around the local store like the SPU does
+	for (i = 0; i < size; i++)
+		p[i] = ctx->ls[(addr + i) & LSLR];
+
+	v = 0;
+	for (i = 0; i < size; i++)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static u64 reg(u32 n)
+{
+	if (n < 128)
+		return ctx->reg[n][0];
+	if (n == 129)
+		return ctx->pc;
+	return 0;
+}
+
+// checks that an op has imm bytes of immediate, pop values to pop and
+// room to push
+static int fits(u32 pc, u32 imm, u32 len, u32 sp, u32 pop, u32 push)
+{
+	return pc + imm <= len && sp >= pop && sp - pop + push <= AGENT_MAX_STACK;
+}
+
+// evaluates code, returns -1 for anything malformed or unsupported
+int agent_eval(const u8 *code, u32 len, u64 *result)
+{
+	u64 stack[AGENT_MAX_STACK];
+	u64 a, b;
+	u32 sp, pc, steps, n;
+	u8 op;
+
+#define NEED(imm, pop, push)						\
+	do {								\
+		if (!fits(pc, imm, len, sp, pop, push))			\
+			return -1;					\
+	} while (0)
+#define TOP	stack[sp - 1]
+#define NEXT	stack[sp - 2]
+
+	sp = pc = 0;
+	for (steps = 0; steps < AGENT_MAX_STEPS; steps++) {
+		if (pc >= len)
+			return -1;
+		op = code[pc++];
+
+		switch (op) {
+		case AX_ADD ... AX_RSH_UNSIGNED:
+		case AX_BIT_AND ... AX_BIT_XOR:
+		case AX_EQUAL ... AX_LESS_UNSIGNED:
+			NEED(0, 2, 1);
+			a = NEXT;
+			b = TOP;
+			sp--;
+			switch (op) {
+			case AX_ADD: a += b; break;
+			case AX_SUB: a -= b; break;
+			case AX_MUL: a *= b; break;
+			case AX_DIV_SIGNED:
+				// INT64_MIN / -1 traps on the host
+				if (b == 0 || (b == ~0ULL && a == 1ULL << 63))
+					return -1;
+				a = (s64)a / (s64)b;
+				break;
+			case AX_DIV_UNSIGNED:
+				if (b == 0)
+					return -1;
+				a /= b;
+				break;
+			case AX_REM_SIGNED:
+				if (b == 0 || (b == ~0ULL && a == 1ULL << 63))
+					return -1;
+				a = (s64)a % (s64)b;
+				break;
+			case AX_REM_UNSIGNED:
+				if (b == 0)
+					return -1;
+				a %= b;
+				break;
+			case AX_LSH: a = b < 64 ? a << b : 0; break;
+			case AX_RSH_SIGNED: a = (s64)a >> (b < 64 ? b : 63); break;
+			case AX_RSH_UNSIGNED: a = b < 64 ? a >> b : 0; break;
+			case AX_BIT_AND: a &= b; break;
+			case AX_BIT_OR: a |= b; break;
+			case AX_BIT_XOR: a ^= b; break;
+			case AX_EQUAL: a = a == b; break;
+			case AX_LESS_SIGNED: a = (s64)a < (s64)b; break;
+			case AX_LESS_UNSIGNED: a = a < b; break;
+			}
+			TOP = a;
+			break;
+		case AX_LOG_NOT:
+			NEED(0, 1, 1);
+			TOP = !TOP;
+			break;
+		case AX_BIT_NOT:
+			NEED(0, 1, 1);
+			TOP = ~TOP;
+			break;
+		case AX_EXT:
+		case AX_ZERO_EXT:
+			NEED(1, 1, 1);
+			n = code[pc++];
+			if (n == 0 || n >= 64)
+				break;
+			if (op == AX_EXT && (TOP >> (n - 1)) & 1)
+				TOP |= ~0ULL << n;
+			else
+				TOP &= ~(~0ULL << n);
+			break;
+		case AX_REF8:
+		case AX_REF16:
+		case AX_REF32:
+		case AX_REF64:
+			NEED(0, 1, 1);
+			TOP = ref(TOP, 1 << (op - AX_REF8));
+			break;
+		case AX_IF_GOTO:
+		case AX_GOTO:
+			NEED(2, op == AX_IF_GOTO, 0);
+			n = (code[pc] << 8) | code[pc + 1];
+			pc += 2;
+			if (op == AX_GOTO || stack[--sp] != 0)
+				pc = n;
+			break;
+		case AX_CONST8:
+		case AX_CONST16:
+		case AX_CONST32:
+		case AX_CONST64:
+			n = 1 << (op - AX_CONST8);
+			NEED(n, 0, 1);
+			for (a = 0; n > 0; n--)
+				a = (a << 8) | code[pc++];
+			stack[sp++] = a;
+			break;
+		case AX_REG:
+			NEED(2, 0, 1);
+			stack[sp++] = reg((code[pc] << 8) | code[pc + 1]);
+			pc += 2;
+			break;
+		case AX_END:
+			if (sp == 0)
+				return -1;
+			*result = TOP;
+			return 0;
+		case AX_DUP:
+			NEED(0, 1, 2);
+			stack[sp] = TOP;
+			sp++;
+			break;
+		case AX_POP:
+			NEED(0, 1, 0);
+			sp--;
+			break;
+		case AX_SWAP:
+			NEED(0, 2, 2);
+			a = TOP;
+			TOP = NEXT;
+			NEXT = a;
+			break;
+		case AX_PICK:
+			NEED(1, 0, 1);
+			n = code[pc++];
+			if (n >= sp)
+				return -1;
+			stack[sp] = stack[sp - 1 - n];
+			sp++;
+			break;
+		case AX_ROT:
+			// a b c -> c a b
+			NEED(0, 3, 3);
+			a = stack[sp - 3];
+			b = NEXT;
+			stack[sp - 3] = TOP;
+			NEXT = a;
+			TOP = b;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+#undef NEED
+#undef TOP
+#undef NEXT
+	return -1;
+}
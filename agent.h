@@ -0,0 +1,19 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef AGENT_H__
+#define AGENT_H__
+
+#include "types.h"
+
+// gdb agent expressions (gdb manual, "Agent Expressions") over ctx.
+// reg n pushes the preferred word of register n (129 is the pc), memory
+// references read the local store big endian. floating point, tracing,
+// trace state variables and printf are not supported.
+#define AGENT_MAX_STACK	64
+#define AGENT_MAX_STEPS	10000
+
+int agent_eval(const u8 *code, u32 len, u64 *result);
+
+#endif
@@ -0,0 +1,257 @@
+#!/usr/bin/env python
+# Copyright 2010 fail0verflow <master@fail0verflow.com>
+# Licensed under the terms of the GNU GPL, version 2
+# http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+# ahead of time translation of a program for the aot engine (see aot.h).
+# the code reachable from the entry point and the function symbols through
+# direct branches is split into regions, runs of words that end in a
+# branch. every region becomes a C function that calls the instrs handlers
+# with the operands decoded here; compiled with emulate-instrs.c they
+# inline into straight line code. indirect branch targets, words that
+# don't decode and anything written at run time are left to the
+# interpreter.
+#
+# usage: aot-generate.py instrs input.elf output.c
+# then:  cc -O2 -fPIC -fvisibility=hidden -shared -I<anergistic> -o out.so output.c
+#        anergistic --aot=out.so --engine=aot input.elf
+# or:    make input.aot.so
+
+from __future__ import print_function
+
+import os, sys, struct
+
+LS_SIZE = 256 * 1024
+LSLR = LS_SIZE - 1
+OPCODE_MAX = 11
+
+widths = {"rr": 11, "rrr": 4, "ri7": 11, "ri10": 8, "ri16": 9, "ri18": 7, "special": 11}
+
+class Instr:
+	def __init__(self, name, format, attributes):
+		self.name = name
+		self.format = format
+		self.attributes = attributes
+		self.body = ""
+
+	def has(self, attribute):
+		return attribute in self.attributes
+
+	# may look at, change or stop at ctx->pc, or pause the context
+	def exits(self):
+		return (self.format == "special" or not self.body.strip() or
+			"ctx->pc" in self.body or
+			self.has("branch") or self.has("stop") or self.has("trap"))
+
+	def target(self):
+		"operand the branch goes to: rel, abs or None for a register"
+		for attrib in self.attributes:
+			if attrib[:4] == "asm=":
+				for op in attrib[4:].split(":"):
+					if op in ("rel", "abs"):
+						return op
+		return None
+
+def load_instrs(path):
+	optbl = [None] * (1 << OPCODE_MAX)
+	current, body = None, False
+	for line in open(path):
+		if line[0] in "{}":
+			body = line[0] == "{"
+			continue
+		if body:
+			current.body += line
+			continue
+		line = line.strip()
+		if not line or line[0] == "#":
+			continue
+		f = line.split(",")
+		current = Instr(f[2], f[1], f[3:])
+		l = widths[f[1]]
+		opcode = int(f[0], 2) << (OPCODE_MAX - l)
+		for i in range(1 << (OPCODE_MAX - l)):
+			optbl[opcode + i] = current
+	return optbl
+
+def load_elf(path):
+	"the local store as elf_load() leaves it, executable ranges, entry points"
+	data = open(path, "rb").read()
+	if data[:6] != b"\x7fELF\x01\x02":
+		raise ValueError("%s is not a 32 bit big endian ELF" % path)
+	(entry, phoff, shoff) = struct.unpack(">III", data[0x18:0x24])
+	(phnum, shentsize, shnum) = struct.unpack(">HHH", data[0x2c:0x32])
+
+	ls = bytearray(LS_SIZE)
+	code = []
+	for i in range(phnum):
+		(type, offset, vaddr, paddr, filesz, memsz, flags, align) = \
+			struct.unpack(">8I", data[phoff + 0x20 * i:phoff + 0x20 * i + 0x20])
+		if type != 1:
+			continue
+		if paddr + filesz > LS_SIZE:
+			raise ValueError("phdr exceeds local storage")
+		ls[paddr:paddr + filesz] = data[offset:offset + filesz]
+		if flags & 1:
+			code.append((paddr, min(paddr + memsz, LS_SIZE)))
+
+	entries = set([entry & LSLR])
+	sections = [struct.unpack(">10I", data[shoff + shentsize * i:shoff + shentsize * i + 40])
+		for i in range(shnum)]
+	for sh in sections:
+		# SHT_SYMTAB, STT_FUNC symbols
+		if sh[1] != 2:
+			continue
+		for off in range(sh[4], sh[4] + sh[5], 16):
+			(name, value, size, info, other, shndx) = struct.unpack(">IIIBBH", data[off:off + 16])
+			if info & 0xf == 2:
+				entries.add(value & LSLR)
+	return ls, code, entries
+
+def bits(w, start, end):
+	return (w >> (31 - end)) & ((1 << (end - start + 1)) - 1)
+
+def se(v, n):
+	return v - (1 << n) if v & (1 << (n - 1)) else v
+
+def call(instr, w):
+	"the handler call for word w, operands in emulate_instr() order"
+	f = instr.format
+	if f == "special":
+		args = [w]
+	elif f == "rrr":
+		args = [bits(w, 4, 10), bits(w, 18, 24), bits(w, 11, 17), bits(w, 25, 31)]
+	elif f == "rr":
+		args = [bits(w, 25, 31), bits(w, 18, 24), bits(w, 11, 17)]
+	elif f == "ri7":
+		args = [bits(w, 25, 31), bits(w, 18, 24), bits(w, 11, 17)]
+	elif f == "ri10":
+		args = [bits(w, 25, 31), bits(w, 18, 24), bits(w, 8, 17)]
+	elif f == "ri16":
+		args = [bits(w, 25, 31), bits(w, 9, 24)]
+	else:
+		args = [bits(w, 25, 31), bits(w, 7, 24)]
+	return "instr_%s(%s)" % (instr.name, ", ".join("0x%x" % a for a in args))
+
+class Program:
+	def __init__(self, optbl, ls, code, entries):
+		self.optbl = optbl
+		self.ls = ls
+		self.code = code
+		self.leaders = {}	# pc -> address of the branch ending its region
+		todo = sorted(entries)
+		seen = set(todo)
+		while todo:
+			pc = todo.pop()
+			end = self.walk(pc)
+			if end is None:
+				continue
+			self.leaders[pc] = end
+			for succ in self.successors(end):
+				if succ not in seen:
+					seen.add(succ)
+					todo.append(succ)
+
+	def word(self, pc):
+		return struct.unpack(">I", bytes(self.ls[pc:pc + 4]))[0]
+
+	def instr(self, pc):
+		return self.optbl[self.word(pc) >> 21]
+
+	def executable(self, pc):
+		return pc & 3 == 0 and any(lo <= pc and pc + 4 <= hi for lo, hi in self.code)
+
+	def walk(self, pc):
+		"the branch pc runs to, None if a word on the way doesn't decode"
+		while self.executable(pc):
+			instr = self.instr(pc)
+			if instr is None:
+				return None
+			if instr.has("branch"):
+				return pc
+			pc += 4
+		return None
+
+	def successors(self, pc):
+		instr = self.instr(pc)
+		w = self.word(pc)
+		succ = []
+		if instr.target() == "rel":
+			succ.append((pc + (se(bits(w, 9, 24), 16) << 2)) & LSLR)
+		elif instr.target() == "abs":
+			succ.append((bits(w, 9, 24) << 2) & LSLR)
+		# conditional branches and calls come back
+		if instr.has("rdrt") or instr.has("call"):
+			succ.append((pc + 4) & LSLR)
+		return succ
+
+	def regions(self):
+		"(start, end, entries) per region, end is the branch"
+		ends = {}
+		for pc, end in self.leaders.items():
+			ends.setdefault(end, []).append(pc)
+		return sorted((min(pcs), end, sorted(pcs)) for end, pcs in ends.items())
+
+	def emit(self, out, name):
+		regions = self.regions()
+		out.write("// translated from %s by aot-generate.py, do not edit\n\n" % name)
+		out.write('#include "emulate-instrs.c"\n#include "aot.h"\n\n')
+		out.write("""// a handler that doesn't look at ctx->pc, which is only set to stop there
+#define I(a, call) do { n++; if ((res = call) != 0) { ctx->pc = a; goto out; } } while (0)
+// one that may use, change or stop at ctx->pc. the block ends where
+// emulate_block() would.
+#define J(a, call) do { n++; ctx->pc = a; if ((res = call) != 0) goto out; \\
+	ctx->pc = (ctx->pc + 4) & LSLR; \\
+	if (ctx->paused || ctx->pc != (((a) + 4) & LSLR)) goto next; } while (0)
+// the branch ending the region
+#define B(a, call) do { n++; ctx->pc = a; if ((res = call) != 0) goto out; \\
+	ctx->pc = (ctx->pc + 4) & LSLR; goto next; } while (0)
+
+""")
+		for start, end, entries in regions:
+			out.write("static const u8 c_%05x[] = {" % start)
+			for i, b in enumerate(self.ls[start:end + 4]):
+				out.write("%s0x%02x," % (i % 16 and " " or "\n\t", b))
+			out.write("\n};\n\n")
+
+			out.write("static u32 r_%05x(u32 pc)\n{\n\tu32 n = 0;\n\tint res;\n\n\tswitch (pc) {\n" % start)
+			for pc in entries:
+				out.write("\tcase 0x%05x: goto l_%05x;\n" % (pc, pc))
+			out.write("\t}\n")
+			for pc in range(start, end + 4, 4):
+				if pc in entries:
+					out.write("l_%05x:\n" % pc)
+				instr = self.instr(pc)
+				kind = pc == end and "B" or instr.exits() and "J" or "I"
+				out.write("\t%s(0x%05x, %s);\n" % (kind, pc, call(instr, self.word(pc))))
+			out.write("next:\n\tif ((ctx->pc & 3) != 0)\n"
+				'\t\tfail("pc is not aligned: %08x", ctx->pc);\n'
+				"out:\n\tctx->instrs += n;\n\treturn res;\n}\n\n")
+
+		blocks = sorted((pc, start, end) for start, end, entries in regions for pc in entries)
+		out.write("AOT_EXPORT const u32 aot_version = AOT_VERSION;\n")
+		out.write("AOT_EXPORT const u32 aot_ctx_size = sizeof(struct ctx_t);\n")
+		out.write("AOT_EXPORT const u32 aot_n_blocks = %d;\n" % len(blocks))
+		out.write("AOT_EXPORT const struct aot_block aot_blocks[] = {\n")
+		for pc, start, end in blocks:
+			out.write("\t{0x%05x, 0x%05x, %d, c_%05x, r_%05x},\n" % (pc, start, end + 4 - start, start, start))
+		if not blocks:
+			out.write("\t{0, 0, 0, NULL, NULL},\n")
+		out.write("};\n")
+
+def main():
+	if len(sys.argv) != 4:
+		print("usage: aot-generate.py instrs input.elf output.c")
+		return 1
+	try:
+		ls, code, entries = load_elf(sys.argv[2])
+	except (IOError, ValueError, struct.error) as e:
+		print("%s: %s" % (sys.argv[2], e))
+		return 1
+	program = Program(load_instrs(sys.argv[1]), ls, code, entries)
+	out = open(sys.argv[3], "w")
+	program.emit(out, os.path.basename(sys.argv[2]))
+	out.close()
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
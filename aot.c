@@ -0,0 +1,129 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "emulate.h"
+#include "engine.h"
+#include "hook.h"
+#include "dirty.h"
+#include "aot.h"
+
+// the block entering at each local store word, if one was translated
+static const struct aot_block *table[LS_SIZE / 4];
+static const struct aot_block *blocks;
+static u32 n_blocks;
+
+// a block whose checked[] is the current epoch matched the local store
+// and none of its pages has been written since. the epoch moves on with
+// the local store and its ls_gen.
+static __thread u32 *checked;
+static __thread u32 epoch;
+static __thread const u8 *epoch_ls;
+static __thread u32 epoch_gen;
+
+#ifdef _WIN32
+void aot_load(const char *path)
+{
+	fail("aot: unable to load %s, not supported on this platform", path);
+}
+#else
+void aot_load(const char *path)
+{
+	const u32 *version, *ctx_size, *n;
+	char name[4096];
+	void *so;
+	u32 i;
+
+	// dlopen() searches the library path for a name without a slash
+	if (strchr(path, '/') == NULL) {
+		snprintf(name, sizeof name, "./%s", path);
+		so = dlopen(name, RTLD_NOW);
+	} else {
+		so = dlopen(path, RTLD_NOW);
+	}
+	if (so == NULL) {
+		printf("aot: %s\n", dlerror());
+		fail("aot: unable to load %s", path);
+		return;
+	}
+
+	version = dlsym(so, "aot_version");
+	ctx_size = dlsym(so, "aot_ctx_size");
+	n = dlsym(so, "aot_n_blocks");
+	blocks = dlsym(so, "aot_blocks");
+	if (version == NULL || ctx_size == NULL || n == NULL || blocks == NULL)
+		fail("aot: %s is not a translated program", path);
+	if (*version != AOT_VERSION || *ctx_size != sizeof(struct ctx_t))
+		fail("aot: %s was built for another version of anergistic", path);
+
+	for (i = 0; i < *n; i++)
+		table[(blocks[i].pc & LSLR) >> 2] = &blocks[i];
+	n_blocks = *n;
+}
+#endif
+
+// whether the local store still holds the region of b from pc on as it
+// was translated. it is only compared again after a write to its pages.
+static int aot_valid(const struct aot_block *b, u32 pc, u32 end)
+{
+	u64 pages;
+	u32 i;
+
+	if (checked == NULL) {
+		checked = calloc(n_blocks, sizeof *checked);
+		if (checked == NULL) {
+			fail("aot: unable to allocate the checked blocks");
+			return 0;
+		}
+	}
+	if (epoch == 0 || ctx->ls != epoch_ls || ctx->ls_gen != epoch_gen) {
+		epoch++;
+		epoch_ls = ctx->ls;
+		epoch_gen = ctx->ls_gen;
+	}
+
+	i = b - blocks;
+	pages = (~0ULL >> (63 - ((end - 1) >> DIRTY_PAGE_SHIFT))) &
+		(~0ULL << (pc >> DIRTY_PAGE_SHIFT));
+	if (checked[i] == epoch && (ctx->dirty & pages) == 0)
+		return 1;
+
+	if (memcmp(ctx->ls + pc, b->code + (pc - b->start), end - pc) != 0)
+		return 0;
+	if ((ctx->dirty & pages) == 0)
+		checked[i] = epoch;
+	return 1;
+}
+
+static u32 aot_block(void)
+{
+	const struct aot_block *b;
+	u32 pc, end, addr;
+
+	pc = ctx->pc;
+	b = table[pc >> 2];
+	if (b == NULL || engine_watched())
+		return emulate_block();
+
+	end = b->start + b->len;
+	if (!aot_valid(b, pc, end))
+		return emulate_block();
+	for (addr = pc; addr < end; addr += 4)
+		if (hook_check(addr))
+			return emulate_block();
+
+	return b->run(pc);
+}
+
+// blocks translated by aot-generate.py, the interpreter for the rest
+const struct engine engine_aot = {"aot", aot_block};
@@ -0,0 +1,36 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef AOT_H__
+#define AOT_H__
+
+#include "types.h"
+
+// aot-generate.py translates the code of a program ahead of time into C
+// that calls the instrs handlers with constant operands. the shared
+// object built from it exports aot_version, aot_ctx_size (its idea of
+// sizeof(struct ctx_t)), aot_n_blocks and aot_blocks.
+//
+// a region is a run of words ending in a branch, a block enters it at pc
+// and runs to the end of it like engine->block(). the aot engine only
+// runs a block while the local store still holds the region from pc on
+// as it was translated and none of it is hooked, everything else goes to
+// the interpreter.
+#define AOT_VERSION	1
+
+// the translation is built with -fvisibility=hidden so that the handlers
+// bind locally and inline, this is what anergistic looks up
+#define AOT_EXPORT	__attribute__((visibility("default")))
+
+struct aot_block {
+	u32 pc;
+	u32 start;		// first word of the region
+	u32 len;		// bytes in the region
+	const u8 *code;		// the region as translated
+	u32 (*run)(u32 pc);
+};
+
+void aot_load(const char *path);
+
+#endif
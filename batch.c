@@ -0,0 +1,509 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "image.h"
+#include "engine.h"
+#include "dirty.h"
+#include "gdb.h"
+#include "batch.h"
+
+#define BATCH_MAX_ARGS	16
+#define BATCH_LINE	4096
+
+struct blob {
+	char *path;
+	u8 *data;
+	u32 size;
+	struct blob *next;
+};
+
+struct input {
+	const struct blob *blob;
+	u32 lsa;
+};
+
+struct region {
+	u32 lsa;
+	u32 len;
+};
+
+struct str {
+	char *p;
+	size_t len;
+	size_t size;
+};
+
+struct job {
+	struct ea_map map;	// first, the put callback casts it back
+	u32 line;
+	char *elf;
+	const struct image *image;
+	struct input in[BATCH_MAX_ARGS];
+	u32 n_in;
+	struct ea_region dma[BATCH_MAX_ARGS];
+	struct region out[BATCH_MAX_ARGS];
+	u32 n_out;
+	u64 budget;
+	struct str puts;
+};
+
+// jobs of one worker. the owner takes from the bottom, thieves from the top.
+struct deque {
+	pthread_mutex_t lock;
+	struct job **jobs;
+	u32 top;
+	u32 bottom;
+};
+
+struct worker {
+	pthread_t thread;
+	u32 id;
+	struct deque q;
+	struct ctx_t ctx;
+	const struct image *image;	// what the reset snapshot of ctx holds
+	u64 jobs;
+	u64 stolen;
+};
+
+static struct blob *blobs;
+static struct worker *workers;
+static u32 n_workers;
+static const struct engine *engine;
+
+static FILE *out_fp;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread jmp_buf *job_jmp;
+static __thread char job_error[256];
+
+// fail() inside a job ends just that job
+void batch_fail(const char *msg)
+{
+	if (job_jmp == NULL)
+		return;
+	snprintf(job_error, sizeof job_error, "%s", msg);
+	longjmp(*job_jmp, 1);
+}
+
+static void str_printf(struct str *s, const char *fmt, ...)
+{
+	va_list va;
+	int n;
+
+	for (;;) {
+		va_start(va, fmt);
+		n = vsnprintf(s->p + s->len, s->size - s->len, fmt, va);
+		va_end(va);
+		if (n >= 0 && s->len + n < s->size)
+			break;
+		s->size = 2 * s->size + 256 + (n > 0 ? n : 0);
+		s->p = realloc(s->p, s->size);
+		if (s->p == NULL)
+			fail("batch: out of memory");
+	}
+	s->len += n;
+}
+
+static void str_hex(struct str *s, const u8 *p, u32 len)
+{
+	u32 i;
+
+	for (i = 0; i < len; i++)
+		str_printf(s, "%02x", p[i]);
+}
+
+static void str_json(struct str *s, const char *p)
+{
+	str_printf(s, "\"");
+	for (; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			str_printf(s, "\\%c", *p);
+		else if ((u8)*p < 0x20)
+			str_printf(s, "\\u%04x", *p);
+		else
+			str_printf(s, "%c", *p);
+	}
+	str_printf(s, "\"");
+}
+
+static const struct blob *load_blob(const char *path)
+{
+	struct blob *b;
+	FILE *fp;
+	long size;
+
+	for (b = blobs; b != NULL; b = b->next)
+		if (strcmp(b->path, path) == 0)
+			return b;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		fail("batch: unable to open %s", path);
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	b = malloc(sizeof *b);
+	if (b == NULL || (b->data = malloc(size + 1)) == NULL)
+		fail("batch: unable to allocate %ld bytes for %s", size, path);
+	if (size > 0 && fread(b->data, size, 1, fp) != 1)
+		fail("batch: unable to read %s", path);
+	fclose(fp);
+
+	b->path = strdup(path);
+	b->size = size;
+	b->next = blobs;
+	blobs = b;
+	return b;
+}
+
+static int parse_addr(const char *s, char sep, u64 *a, u64 *b)
+{
+	char *end;
+
+	*a = strtoull(s, &end, 0);
+	if (*end != sep)
+		return -1;
+	*b = strtoull(end + 1, &end, 0);
+	return *end == 0 ? 0 : -1;
+}
+
+// one job per line: elf [in=file@lsa] [dma=file@ea] [out=lsa:len] [budget=n]
+static void parse_job(struct job *j, char *line, u32 n, const char *manifest)
+{
+	const struct blob *b;
+	char *tok, *arg, *at;
+	u64 a, len;
+
+	memset(j, 0, sizeof *j);
+	j->line = n;
+	j->map.regions = j->dma;
+
+	tok = strtok(line, " \t\r\n");
+	// every distinct ELF is loaded once, here on the main thread, and
+	// shared by all workers
+	j->image = image_get(tok);
+	if (j->image == NULL)
+		fail("batch: %s:%u: unable to load %s", manifest, n, tok);
+	j->elf = strdup(tok);
+
+	while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+		arg = strchr(tok, '=');
+		if (arg == NULL)
+			goto bad;
+		*arg++ = 0;
+
+		if (strcmp(tok, "budget") == 0) {
+			j->budget = strtoull(arg, NULL, 0);
+		} else if (strcmp(tok, "out") == 0) {
+			if (j->n_out == BATCH_MAX_ARGS || parse_addr(arg, ':', &a, &len) < 0 ||
+			    a >= LS_SIZE || len > LS_SIZE - a)
+				goto bad;
+			j->out[j->n_out].lsa = a;
+			j->out[j->n_out].len = len;
+			j->n_out++;
+		} else if (strcmp(tok, "in") == 0 || strcmp(tok, "dma") == 0) {
+			at = strrchr(arg, '@');
+			if (at == NULL)
+				goto bad;
+			*at++ = 0;
+			b = load_blob(arg);
+			a = strtoull(at, NULL, 0);
+			if (tok[0] == 'i') {
+				if (j->n_in == BATCH_MAX_ARGS || a >= LS_SIZE || b->size > LS_SIZE - a)
+					goto bad;
+				j->in[j->n_in].blob = b;
+				j->in[j->n_in].lsa = a;
+				j->n_in++;
+			} else {
+				if (j->map.n_regions == BATCH_MAX_ARGS)
+					goto bad;
+				j->dma[j->map.n_regions].ea = a;
+				j->dma[j->map.n_regions].size = b->size;
+				j->dma[j->map.n_regions].data = b->data;
+				j->map.n_regions++;
+			}
+		} else {
+			goto bad;
+		}
+	}
+	return;
+
+bad:
+	fail("batch: %s:%u: bad argument %s", manifest, n, tok);
+}
+
+static struct job *parse_manifest(const char *path, u32 *n_jobs)
+{
+	char line[BATCH_LINE];
+	struct job *jobs;
+	u32 n, size, i;
+	char *p;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		fail("batch: unable to open %s", path);
+
+	jobs = NULL;
+	size = n = 0;
+	for (i = 1; fgets(line, sizeof line, fp) != NULL; i++) {
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+			;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+			continue;
+
+		if (n == size) {
+			size = size ? 2 * size : 64;
+			jobs = realloc(jobs, size * sizeof *jobs);
+			if (jobs == NULL)
+				fail("batch: out of memory");
+		}
+		parse_job(&jobs[n++], p, i, path);
+	}
+	fclose(fp);
+
+	*n_jobs = n;
+	return jobs;
+}
+
+static void job_put(struct ea_map *map, u64 ea, const u8 *data, u32 size)
+{
+	struct job *j = (struct job *)map;
+
+	str_printf(&j->puts, "%s{\"ea\": \"0x%llx\", \"data\": \"", j->puts.len ? ", " : "", ea);
+	str_hex(&j->puts, data, size);
+	str_printf(&j->puts, "\"}");
+}
+
+static void report(struct job *j, const char *status, double secs)
+{
+	struct str s;
+	u32 i;
+
+	memset(&s, 0, sizeof s);
+	str_printf(&s, "{\"job\": %u, \"elf\": ", j->line);
+	str_json(&s, j->elf);
+	str_printf(&s, ", \"status\": \"%s\", \"stop\": %u, \"pc\": \"0x%05x\", "
+		"\"instructions\": %llu, \"seconds\": %.6f",
+		status, ctx->stop_code, ctx->pc, ctx->instrs, secs);
+	if (job_error[0]) {
+		str_printf(&s, ", \"error\": ");
+		str_json(&s, job_error);
+	}
+
+	str_printf(&s, ", \"out\": {");
+	for (i = 0; i < j->n_out; i++) {
+		str_printf(&s, "%s\"0x%05x\": \"", i ? ", " : "", j->out[i].lsa);
+		str_hex(&s, ctx->ls + j->out[i].lsa, j->out[i].len);
+		str_printf(&s, "\"");
+	}
+	str_printf(&s, "}, \"puts\": [%s]}\n", j->puts.len ? j->puts.p : "");
+
+	pthread_mutex_lock(&out_lock);
+	fwrite(s.p, s.len, 1, out_fp);
+	fflush(out_fp);
+	pthread_mutex_unlock(&out_lock);
+
+	free(s.p);
+	free(j->puts.p);
+	j->puts.p = NULL;
+}
+
+static void run_job(struct worker *w, struct job *j)
+{
+	struct timeval start, end;
+	const char *status;
+	jmp_buf jmp;
+	u32 i, res;
+
+	// the worker's local store is a copy-on-write mapping of the image,
+	// it goes back to it through the dirty pages of the last job and is
+	// only mapped again when the image changes
+	if (w->image != j->image) {
+		if (ctx->ls != NULL)
+			image_unmap(w->image, ctx->ls);
+		ctx->ls = image_map(j->image);
+		if (ctx->ls == NULL)
+			fail("batch: unable to map %s", j->elf);
+		memset(ctx->reg, 0, sizeof ctx->reg);
+		memset(&ctx->mfc, 0, sizeof ctx->mfc);
+		ctx->pc = j->image->entry;
+		dirty_share(j->image->ls);
+		w->image = j->image;
+	} else {
+		dirty_reset();
+	}
+	ctx->instrs = 0;
+	ctx->stop_code = 0;
+	ctx->ea = &j->map;
+	j->map.put = job_put;
+	job_error[0] = 0;
+
+	for (i = 0; i < j->n_in; i++) {
+		dirty_mark(j->in[i].lsa, j->in[i].blob->size);
+		memcpy(ctx->ls + j->in[i].lsa, j->in[i].blob->data, j->in[i].blob->size);
+	}
+
+	gettimeofday(&start, NULL);
+	if (setjmp(jmp) == 0) {
+		job_jmp = &jmp;
+		// with gdb, a worker stops when it has its first job
+		if (ctx->paused)
+			gdb_signal(SIGABRT);
+		for (;;) {
+			if (ctx->paused)
+				gdb_handle_events();
+			res = engine->block();
+			// data watchpoints
+			if (res == 2) {
+				ctx->paused = 1;
+				gdb_signal(SIGTRAP);
+			} else if (res != 0) {
+				status = "stop";
+				break;
+			}
+			if (gdb_interrupt)
+				gdb_break();
+			if (j->budget != 0 && ctx->instrs >= j->budget) {
+				status = "budget";
+				break;
+			}
+		}
+	} else {
+		status = "error";
+	}
+	job_jmp = NULL;
+	gettimeofday(&end, NULL);
+
+	report(j, status, (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+	ctx->ea = NULL;
+	w->jobs++;
+}
+
+static struct job *take(struct deque *q, int steal)
+{
+	struct job *j = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->bottom > q->top)
+		j = steal ? q->jobs[q->top++] : q->jobs[--q->bottom];
+	pthread_mutex_unlock(&q->lock);
+	return j;
+}
+
+// no job creates new ones, so once every deque is empty we are done
+static struct job *next_job(struct worker *w)
+{
+	struct job *j;
+	u32 i;
+
+	j = take(&w->q, 0);
+	for (i = 1; j == NULL && i < n_workers; i++) {
+		j = take(&workers[(w->id + i) % n_workers].q, 1);
+		if (j != NULL)
+			w->stolen++;
+	}
+	return j;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct job *j;
+
+	ctx = &w->ctx;
+
+	while ((j = next_job(w)) != NULL)
+		run_job(w, j);
+	gdb_exit_thread();
+
+	dirty_free();
+	if (ctx->ls != NULL)
+		image_unmap(w->image, ctx->ls);
+	return NULL;
+}
+
+int batch_run(const char *manifest, const char *output, u32 threads, const struct engine *e)
+{
+	struct timeval start, end;
+	struct job *jobs;
+	u32 n_jobs, i;
+	u64 stolen;
+
+	engine = e;
+	jobs = parse_manifest(manifest, &n_jobs);
+
+	if (threads == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (threads == 0)
+			threads = 1;
+	}
+	if (threads > n_jobs && n_jobs > 0)
+		threads = n_jobs;
+
+	out_fp = strcmp(output, "-") == 0 ? stdout : fopen(output, "w");
+	if (out_fp == NULL)
+		fail("batch: unable to create %s", output);
+
+	// deal the jobs out round robin, stealing evens out the rest
+	n_workers = threads;
+	workers = calloc(n_workers, sizeof *workers);
+	if (workers == NULL)
+		fail("batch: out of memory");
+	for (i = 0; i < n_workers; i++) {
+		workers[i].id = i;
+		pthread_mutex_init(&workers[i].q.lock, NULL);
+		workers[i].q.jobs = malloc((n_jobs / n_workers + 1) * sizeof *workers[i].q.jobs);
+		if (workers[i].q.jobs == NULL)
+			fail("batch: out of memory");
+	}
+	for (i = 0; i < n_jobs; i++) {
+		struct deque *q = &workers[i % n_workers].q;
+
+		q->jobs[q->bottom++] = &jobs[n_jobs - 1 - i];
+	}
+
+	// each worker's context is a thread to gdb
+	for (i = 0; i < n_workers; i++)
+		gdb_add_thread(&workers[i].ctx);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < n_workers; i++)
+		if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+			fail("batch: unable to start worker %u", i);
+	gdb_start();
+
+	stolen = 0;
+	for (i = 0; i < n_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		stolen += workers[i].stolen;
+		free(workers[i].q.jobs);
+		pthread_mutex_destroy(&workers[i].q.lock);
+	}
+	gettimeofday(&end, NULL);
+
+	if (out_fp != stdout)
+		fclose(out_fp);
+	printf("batch: %u jobs on %u threads in %.3fs, %llu stolen\n", n_jobs, n_workers,
+		(end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6, stolen);
+
+	free(workers);
+	free(jobs);
+	return 0;
+}
@@ -0,0 +1,17 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef BATCH_H__
+#define BATCH_H__
+
+#include "types.h"
+#include "engine.h"
+
+// runs every job of a manifest on a pool of threads, one context each, and
+// writes one JSON line per job to output. with gdb, every worker's context
+// is a gdb thread that stops at the start of its first job.
+int batch_run(const char *manifest, const char *output, u32 threads, const struct engine *e);
+void batch_fail(const char *msg);
+
+#endif
@@ -0,0 +1,198 @@
+#!/usr/bin/env python
+# Copyright 2010 fail0verflow <master@fail0verflow.com>
+# Licensed under the terms of the GNU GPL, version 2
+# http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+# runs every benchmark kernel under every execution mode of the emulator,
+# checks the final registers and local store against the checksums in
+# bench/expected and reports instructions per second, host cycles per
+# guest instruction and peak RSS.
+#
+# usage: bench.py [-r repeats] [-k kernel] [-u] path/to/anergistic
+#   -r	timed runs per kernel and mode, the fastest one is reported (3)
+#   -k	only run this kernel (may be given more than once)
+#   -u	rewrite bench/expected from this run instead of checking it
+
+from __future__ import print_function
+
+import os, sys, re, json, time, getopt, struct, hashlib, shutil, tempfile, subprocess
+
+import spuasm
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+SRC_DIR = os.path.join(BENCH_DIR, "..")
+INSTRS = os.path.join(SRC_DIR, "instrs")
+EXPECTED = os.path.join(BENCH_DIR, "expected")
+
+KERNELS = ["intloop", "crypto", "branchy", "stream", "dma"]
+
+def aot_translate(elf):
+	"translates the kernel with aot-generate.py, needs emulate-instrs.c built"
+	base = elf[:-len(".elf")] + ".aot"
+	subprocess.check_call([sys.executable, os.path.join(SRC_DIR, "aot-generate.py"), INSTRS, elf, base + ".c"])
+	subprocess.check_call([os.environ.get("CC", "cc"), "-O2", "-fPIC", "-fvisibility=hidden",
+		"-shared", "-I", SRC_DIR, "-o", base + ".so", base + ".c"])
+	return ["--engine=aot", "--aot=" + base + ".so"]
+
+# execution modes: name, extra emulator arguments or a function returning
+# them for the kernel's ELF. every mode has to end up with the same
+# registers and local store.
+MODES = [
+	("interp", []),
+	("hooks", ["-n"]),
+	("fuse", ["--engine=fuse"]),
+	("aot", aot_translate),
+]
+
+if hasattr(time, "perf_counter"):
+	clock = time.perf_counter
+else:
+	clock = time.time
+
+def dma_replay(path):
+	"channel input for dma.s: 64 GETs of 16KB into alternating buffers"
+	blocks, size = 64, 0x4000
+	f = open(path, "wb")
+	f.write(struct.pack(">4sI", b"ANRP", 1))
+	def get(i):
+		f.write(struct.pack(">BII", 3, 0x10000 + (i & 1) * size, size))
+		f.write(bytes(bytearray((i * 131 + j * 7) & 0xff for j in range(size))))
+	get(0)
+	for i in range(blocks):
+		if i + 1 < blocks:
+			get(i + 1)
+		f.write(struct.pack(">BBI", 1, 24, 1 << (i & 1)))
+	f.close()
+	return ["--replay=" + path]
+
+INPUTS = {"dma": dma_replay}
+
+def cpu_mhz():
+	try:
+		for line in open("/proc/cpuinfo"):
+			if line.startswith("cpu MHz"):
+				return float(line.split(":")[1])
+	except IOError:
+		pass
+	return None
+
+def run(emu, args, cwd):
+	"run the emulator once, returns (seconds, peak rss in KB or None)"
+	out = open(os.path.join(cwd, "stdout"), "w")
+	start = clock()
+	p = subprocess.Popen([emu] + args, cwd=cwd, stdout=out, stderr=subprocess.STDOUT)
+	if hasattr(os, "wait4"):
+		_, status, usage = os.wait4(p.pid, 0)
+		p.returncode = status >> 8
+		rss = usage.ru_maxrss
+	else:
+		p.wait()
+		rss = None
+	secs = clock() - start
+	out.close()
+	if p.returncode != 0:
+		raise RuntimeError("%s exited with %d, see %s" % (" ".join(args), p.returncode, out.name))
+	return secs, rss
+
+def checksums(cwd):
+	"checksums of the last register dump on stdout and of the dumped local store"
+	text = open(os.path.join(cwd, "stdout")).read()
+	dump = text[text.rfind("Register dump:"):]
+	regs = re.findall(r"^(?: pc|\d{3}):\t.*$", dump, re.M)[:129]
+	ls = open(os.path.join(cwd, "ls.b"), "rb").read()
+	return (hashlib.sha1("\n".join(regs).encode()).hexdigest()[:16],
+		hashlib.sha1(ls).hexdigest()[:16])
+
+def load_expected():
+	expected = {}
+	if os.path.exists(EXPECTED):
+		for line in open(EXPECTED):
+			f = line.split()
+			if len(f) == 3 and not f[0].startswith("#"):
+				expected[f[0]] = (f[1], f[2])
+	return expected
+
+def save_expected(expected):
+	f = open(EXPECTED, "w")
+	f.write("# kernel, register checksum, local store checksum (bench.py -u)\n")
+	for k in KERNELS:
+		if k in expected:
+			f.write("%s %s %s\n" % (k, expected[k][0], expected[k][1]))
+	f.close()
+
+def main():
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], "r:k:u")
+	except getopt.GetoptError as e:
+		print(e)
+		args = []
+	if len(args) != 1:
+		print("usage: bench.py [-r repeats] [-k kernel] [-u] path/to/anergistic")
+		return 1
+
+	repeats, kernels, update = 3, [], False
+	for o, a in opts:
+		if o == "-r":
+			repeats = int(a)
+		elif o == "-k":
+			kernels.append(a)
+		elif o == "-u":
+			update = True
+
+	emu = os.path.abspath(args[0])
+	expected = load_expected()
+	mhz = cpu_mhz()
+	ops = spuasm.load_instrs(INSTRS)
+	failed = 0
+
+	print("%-8s %-7s %10s %8s %9s %12s %9s  %s" %
+		("kernel", "mode", "instrs", "MIPS", "ns/instr", "cycles/instr", "rss KB", "check"))
+	for k in kernels or KERNELS:
+		tmp = tempfile.mkdtemp(prefix="anergistic-bench-")
+		try:
+			elf = os.path.join(tmp, k + ".elf")
+			image, entry, funcs = spuasm.assemble(ops, spuasm.parse(os.path.join(BENCH_DIR, k + ".s")))
+			spuasm.write_elf(elf, image, entry, funcs)
+			inputs = INPUTS[k](os.path.join(tmp, k + ".in")) if k in INPUTS else []
+
+			for mode, margs in MODES:
+				if callable(margs):
+					margs = margs(elf)
+				# --stats makes the other engines fall back to the
+				# interpreter, it only counts the instructions here. the
+				# timed runs are the ones checked.
+				run(emu, margs + inputs + ["--stats=stats.json", elf], tmp)
+				instrs = json.load(open(os.path.join(tmp, "stats.json")))["instructions"]
+
+				best, rss, runs = None, None, []
+				for i in range(max(repeats, 1)):
+					secs, r = run(emu, margs + inputs + [elf], tmp)
+					best = secs if best is None else min(best, secs)
+					rss = r if rss is None else max(rss, r)
+					runs.append(checksums(tmp))
+
+				if update and mode == MODES[0][0]:
+					expected[k] = runs[0]
+				bad = [sums for sums in runs if sums != expected.get(k, sums)]
+				if k not in expected:
+					check = "new"
+				elif not bad:
+					check = "ok"
+				else:
+					check = "FAIL %s %s" % bad[0]
+					failed += 1
+
+				ns = best * 1e9 / instrs
+				print("%-8s %-7s %10d %8.2f %9.2f %12s %9s  %s" % (k, mode, instrs,
+					instrs / best / 1e6, ns, "%.1f" % (ns * mhz / 1e3) if mhz else "-",
+					rss if rss is not None else "-", check))
+				sys.stdout.flush()
+		finally:
+			shutil.rmtree(tmp)
+
+	if update:
+		save_expected(expected)
+	return 1 if failed else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
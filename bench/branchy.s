@@ -0,0 +1,33 @@
+# data dependent branches: collatz sequence lengths of 1..20000
+.func _start
+_start:
+	il $3, 1		# seed
+	il $9, 0		# total steps
+	il $10, 0		# longest sequence
+	ila $11, 20000
+seed:
+	ai $4, $3, 0
+	il $5, 0
+step:
+	ceqi $7, $4, 1
+	brnz $7, done
+	ai $5, $5, 1
+	andi $6, $4, 1
+	brz $6, even
+	a $8, $4, $4
+	a $4, $8, $4
+	ai $4, $4, 1
+	br step
+even:
+	rotmi $4, $4, -1
+	br step
+done:
+	a $9, $9, $5
+	cgt $7, $5, $10
+	brz $7, next
+	ai $10, $5, 0
+next:
+	ai $3, $3, 1
+	ai $11, $11, -1
+	brnz $11, seed
+	stop 0x2000
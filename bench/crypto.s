@@ -0,0 +1,63 @@
+# shufb heavy: ChaCha style double rounds on four state rows, with the
+# 16 and 8 bit rotates and the diagonalisation done by shufb
+.func _start
+_start:
+	lqr $20, rot16
+	lqr $21, rot8
+	lqr $22, word1
+	lqr $23, word2
+	lqr $24, word3
+	lqr $10, state0
+	lqr $11, state1
+	lqr $12, state2
+	lqr $13, state3
+	ilhu $4, 4		# 0x40000 double rounds
+round:
+	a $10, $10, $11
+	xor $13, $13, $10
+	shufb $13, $13, $13, $20
+	a $12, $12, $13
+	xor $11, $11, $12
+	roti $11, $11, 12
+	a $10, $10, $11
+	xor $13, $13, $10
+	shufb $13, $13, $13, $21
+	a $12, $12, $13
+	xor $11, $11, $12
+	roti $11, $11, 7
+	shufb $11, $11, $11, $22
+	shufb $12, $12, $12, $23
+	shufb $13, $13, $13, $24
+	a $10, $10, $11
+	xor $13, $13, $10
+	shufb $13, $13, $13, $20
+	a $12, $12, $13
+	xor $11, $11, $12
+	roti $11, $11, 12
+	a $10, $10, $11
+	xor $13, $13, $10
+	shufb $13, $13, $13, $21
+	a $12, $12, $13
+	xor $11, $11, $12
+	roti $11, $11, 7
+	shufb $11, $11, $11, $24
+	shufb $12, $12, $12, $23
+	shufb $13, $13, $13, $22
+	ai $4, $4, -1
+	brnz $4, round
+	stqr $10, state0
+	stqr $11, state1
+	stqr $12, state2
+	stqr $13, state3
+	stop 0x2000
+
+.align 4
+rot16:	.word 0x02030001, 0x06070405, 0x0a0b0809, 0x0e0f0c0d
+rot8:	.word 0x01020300, 0x05060704, 0x090a0b08, 0x0d0e0f0c
+word1:	.word 0x04050607, 0x08090a0b, 0x0c0d0e0f, 0x00010203
+word2:	.word 0x08090a0b, 0x0c0d0e0f, 0x00010203, 0x04050607
+word3:	.word 0x0c0d0e0f, 0x00010203, 0x04050607, 0x08090a0b
+state0:	.word 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574
+state1:	.word 0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c
+state2:	.word 0x13121110, 0x17161514, 0x1b1a1918, 0x1f1e1d1c
+state3:	.word 0x00000001, 0x00000000, 0x4a000000, 0x00000000
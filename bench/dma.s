@@ -0,0 +1,59 @@
+# DMA double buffering: GET 16KB blocks alternately into two buffers and
+# checksum one while the next one is in flight. needs the channel input
+# bench.py generates (dma_replay) to be run with --replay.
+.func _start
+_start:
+	il $3, 0		# current block
+	il $4, 64		# blocks
+	ila $20, 0x10000	# buffer 0, buffer 1 follows
+	ila $22, 0x4000		# block size
+	il $23, 0x40		# MFC_GET_CMD
+	il $24, 0
+	il $30, 0
+	il $31, 0
+	il $6, 0
+	il $7, 0
+	ai $5, $20, 0
+	brsl $lr, get
+block:
+	ai $7, $3, 1
+	ceq $8, $7, $4
+	brnz $8, wait
+	andi $6, $7, 1
+	shli $9, $6, 14
+	a $5, $20, $9
+	brsl $lr, get
+wait:
+	andi $6, $3, 1
+	il $9, 1
+	shl $9, $9, $6
+	wrch $ch22, $9
+	wrch $ch23, $24
+	rdch $9, $ch24
+	shli $9, $6, 14
+	a $5, $20, $9
+	il $12, 0
+sum:
+	lqx $13, $5, $12
+	a $30, $30, $13
+	xor $31, $31, $30
+	roti $31, $31, 1
+	ai $12, $12, 16
+	ceq $14, $12, $22
+	brz $14, sum
+	ai $3, $3, 1
+	ceq $8, $3, $4
+	brz $8, block
+	stop 0x2000
+
+# DMA GET of block $7 into $5 with tag $6
+.func get
+get:
+	shli $9, $7, 14
+	wrch $ch16, $5
+	wrch $ch17, $24
+	wrch $ch18, $9
+	wrch $ch19, $22
+	wrch $ch20, $6
+	wrch $ch21, $23
+	bi $lr
@@ -0,0 +1,17 @@
+# integer arithmetic: xorshift mixing in a counted loop
+.func _start
+_start:
+	ilhu $4, 0x20		# 0x200000 iterations
+	il $3, 1
+	il $5, 0x1234
+loop:
+	shli $6, $3, 13
+	xor $3, $3, $6
+	rotmi $6, $3, -17
+	xor $3, $3, $6
+	shli $6, $3, 5
+	xor $3, $3, $6
+	a $5, $5, $3
+	ai $4, $4, -1
+	brnz $4, loop
+	stop 0x2000
@@ -0,0 +1,236 @@
+#!/usr/bin/env python
+# Copyright 2010 fail0verflow <master@fail0verflow.com>
+# Licensed under the terms of the GNU GPL, version 2
+# http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+# minimal SPU assembler for the benchmark kernels. opcodes and instruction
+# formats are taken from the instrs table of the emulator itself.
+#
+# usage: spuasm.py instrs input.s output.elf
+
+import sys, re, struct
+
+OPCODE_MAX = 11
+widths = {"rr": 11, "rrr": 4, "ri7": 11, "ri10": 8, "ri16": 9, "ri18": 7, "special": 11}
+
+def load_instrs(path):
+	ops = {}
+	for line in open(path):
+		line = line.strip()
+		if not line or line[0] in "#{}" or not line[0] in "01":
+			continue
+		f = line.split(',')
+		ops[f[2]] = (int(f[0], 2), f[1], f[3:])
+	return ops
+
+# instructions whose operands do not follow the rt, ra, rb order
+layouts = {
+	"bi": ("ra",), "bisl": ("rt", "ra"), "biz": ("rt", "ra"), "binz": ("rt", "ra"),
+	"bihz": ("rt", "ra"), "bihnz": ("rt", "ra"),
+	"rdch": ("rt", "ra"), "rchcnt": ("rt", "ra"), "wrch": ("ra", "rt"),
+	"br": ("i",), "bra": ("i",), "hbr": (), "lnop": (), "nop": (), "sync": (), "dsync": (),
+	"stop": ("i",),
+}
+
+relative = ("br", "brz", "brnz", "brhz", "brhnz", "brsl", "lqr", "stqr")
+absolute = ("bra", "lqa", "stqa")
+
+class Error(Exception):
+	pass
+
+def reg(s):
+	s = s.strip()
+	if s == "$lr":
+		return 0
+	if s == "$sp":
+		return 1
+	m = re.match(r"^\$(?:r)?(\d+)$", s)
+	if not m:
+		raise Error("bad register %s" % s)
+	return int(m.group(1))
+
+def imm(s, labels):
+	s = s.strip()
+	if s in labels:
+		return labels[s]
+	return int(s, 0)
+
+def encode(ops, mn, args, pc, labels):
+	if mn not in ops:
+		raise Error("unknown instruction %s" % mn)
+	opcode, fmt, attrs = ops[mn]
+	w = opcode << (32 - widths[fmt])
+	if fmt == "special":
+		if mn == "stop" and args:
+			w |= imm(args[0], labels) & 0x3fff
+		return w
+
+	# branch hints: hbrr branch, target
+	if mn in ("hbrr", "hbra"):
+		if len(args) != 2:
+			raise Error("%s expects 2 operands" % mn)
+		ro = (imm(args[0], labels) - pc) >> 2
+		t = imm(args[1], labels)
+		t = (t - pc) >> 2 if mn == "hbrr" else t >> 2
+		return w | (((ro >> 7) & 3) << 23) | ((t & 0xffff) << 7) | (ro & 0x7f)
+
+	fields = {"rt": 0, "ra": 0, "rb": 0, "rc": 0, "i": 0}
+	layout = layouts.get(mn)
+	if layout is None:
+		layout = {"rr": ("rt", "ra", "rb"), "rrr": ("rt", "ra", "rb", "rc"),
+			"ri7": ("rt", "ra", "i"), "ri10": ("rt", "ra", "i"),
+			"ri16": ("rt", "i"), "ri18": ("rt", "i")}[fmt]
+
+	# d-form loads and stores: lqd rt, offset(ra)
+	if fmt == "ri10" and len(args) == 2:
+		m = re.match(r"^(.*)\((.*)\)$", args[1].strip())
+		if m:
+			args = [args[0], m.group(2), m.group(1) or "0"]
+
+	if len(args) != len(layout):
+		raise Error("%s expects %d operands" % (mn, len(layout)))
+
+	for name, a in zip(layout, args):
+		if name == "i":
+			fields["i"] = imm(a, labels)
+		elif mn in ("rdch", "rchcnt", "wrch") and name == "ra":
+			fields["ra"] = imm(a.replace("$ch", ""), labels)
+		else:
+			fields[name] = reg(a)
+
+	i = fields["i"]
+	if mn in relative:
+		i = (i - pc) >> 2
+	elif mn in absolute:
+		i >>= 2
+	elif "shift4" in attrs:
+		i >>= 4
+
+	if fmt == "rr":
+		w |= (fields["rb"] << 14) | (fields["ra"] << 7) | fields["rt"]
+	elif fmt == "rrr":
+		w |= (fields["rt"] << 21) | (fields["rb"] << 14) | (fields["ra"] << 7) | fields["rc"]
+	elif fmt == "ri7":
+		w |= ((i & 0x7f) << 14) | (fields["ra"] << 7) | fields["rt"]
+	elif fmt == "ri10":
+		w |= ((i & 0x3ff) << 14) | (fields["ra"] << 7) | fields["rt"]
+	elif fmt == "ri16":
+		w |= ((i & 0xffff) << 7) | fields["rt"]
+	elif fmt == "ri18":
+		w |= ((i & 0x3ffff) << 7) | fields["rt"]
+	return w
+
+def parse(path):
+	lines = []
+	for n, line in enumerate(open(path)):
+		line = line.split("#")[0].split(";")[0].strip()
+		if line:
+			lines.append((n + 1, line))
+	return lines
+
+def assemble(ops, lines):
+	# pass 1: labels
+	labels, funcs, pc = {}, [], 0
+	for n, line in lines:
+		while ":" in line and not line.startswith("."):
+			label, line = line.split(":", 1)
+			labels[label.strip()] = pc
+			line = line.strip()
+		if not line:
+			continue
+		if line.startswith(".func"):
+			funcs.append((line.split()[1], pc))
+		elif line.startswith(".org"):
+			pc = int(line.split()[1], 0)
+		elif line.startswith(".word"):
+			pc += 4 * len(line[5:].split(","))
+		elif line.startswith(".align"):
+			a = 1 << int(line.split()[1])
+			pc = (pc + a - 1) & ~(a - 1)
+		elif line.startswith(".space"):
+			pc += int(line.split()[1], 0)
+		elif not line.startswith("."):
+			pc += 4
+
+	# pass 2: code
+	image, pc = {}, 0
+	for n, line in lines:
+		while ":" in line and not line.startswith("."):
+			line = line.split(":", 1)[1].strip()
+		if not line or line.startswith(".func") or line.startswith(".entry"):
+			continue
+		try:
+			if line.startswith(".org"):
+				pc = int(line.split()[1], 0)
+			elif line.startswith(".word"):
+				for v in line[5:].split(","):
+					image[pc] = imm(v, labels) & 0xffffffff
+					pc += 4
+			elif line.startswith(".align"):
+				a = 1 << int(line.split()[1])
+				pc = (pc + a - 1) & ~(a - 1)
+			elif line.startswith(".space"):
+				pc += int(line.split()[1], 0)
+			else:
+				mn, _, rest = line.partition(" ")
+				args = [a for a in rest.split(",") if a.strip()]
+				image[pc] = encode(ops, mn, args, pc, labels)
+				pc += 4
+		except Error as e:
+			raise Error("line %d: %s" % (n, e))
+
+	entry = labels.get("_start", 0)
+	return image, entry, funcs
+
+def write_elf(path, image, entry, funcs):
+	size = max(image) + 4 if image else 0
+	code = bytearray(size)
+	for a, w in image.items():
+		code[a:a + 4] = struct.pack(">I", w)
+
+	strtab = b"\0"
+	syms = [struct.pack(">IIIBBH", 0, 0, 0, 0, 0, 0)]
+	ends = [a for _, a in funcs[1:]] + [size]
+	for (name, addr), end in zip(funcs, ends):
+		syms.append(struct.pack(">IIIBBH", len(strtab), addr, end - addr, 0x12, 0, 1))
+		strtab += name.encode() + b"\0"
+	symtab = b"".join(syms)
+	shstrtab = b"\0.text\0.symtab\0.strtab\0.shstrtab\0"
+
+	code_off = 0x100
+	symtab_off = code_off + size
+	strtab_off = symtab_off + len(symtab)
+	shstr_off = strtab_off + len(strtab)
+	sh_off = (shstr_off + len(shstrtab) + 3) & ~3
+
+	ehdr = struct.pack(">16sHHIIIIIHHHHHH", b"\x7fELF\x01\x02\x01" + b"\0" * 9,
+		2, 23, 1, entry, 0x34, sh_off, 0, 0x34, 0x20, 1, 0x28, 5, 4)
+	phdr = struct.pack(">IIIIIIII", 1, code_off, 0, 0, size, size, 7, 0x80)
+	shdrs = [
+		struct.pack(">IIIIIIIIII", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0),
+		struct.pack(">IIIIIIIIII", 1, 1, 6, 0, code_off, size, 0, 0, 16, 0),
+		struct.pack(">IIIIIIIIII", 7, 2, 0, 0, symtab_off, len(symtab), 3, 1, 4, 16),
+		struct.pack(">IIIIIIIIII", 15, 3, 0, 0, strtab_off, len(strtab), 0, 0, 1, 0),
+		struct.pack(">IIIIIIIIII", 23, 3, 0, 0, shstr_off, len(shstrtab), 0, 0, 1, 0),
+	]
+
+	out = bytearray(sh_off)
+	out[0:0x34] = ehdr
+	out[0x34:0x54] = phdr
+	out[code_off:code_off + size] = code
+	out[symtab_off:symtab_off + len(symtab)] = symtab
+	out[strtab_off:strtab_off + len(strtab)] = strtab
+	out[shstr_off:shstr_off + len(shstrtab)] = shstrtab
+	out += b"".join(shdrs)
+	open(path, "wb").write(bytes(out))
+
+if __name__ == "__main__":
+	if len(sys.argv) != 4:
+		print("usage: spuasm.py instrs input.s output.elf")
+		sys.exit(1)
+	try:
+		image, entry, funcs = assemble(load_instrs(sys.argv[1]), parse(sys.argv[2]))
+	except Error as e:
+		print("%s: %s" % (sys.argv[2], e))
+		sys.exit(1)
+	write_elf(sys.argv[3], image, entry, funcs)
@@ -0,0 +1,33 @@
+# load/store streaming: fill 64KB, then repeatedly mix it into a second
+# 64KB buffer and swap the two
+.func _start
+_start:
+	ila $3, 0x10000		# source
+	ila $4, 0x20000		# destination
+	ila $5, 0x10000		# length
+	il $6, 0
+	ila $7, 0x10203
+fill:
+	stqx $7, $3, $6
+	ai $7, $7, 0x155
+	ai $6, $6, 16
+	ceq $9, $6, $5
+	brz $9, fill
+	il $12, 256		# passes
+	il $11, 0
+pass:
+	il $6, 0
+copy:
+	lqx $10, $3, $6
+	a $11, $11, $10
+	xor $10, $10, $11
+	stqx $10, $4, $6
+	ai $6, $6, 16
+	ceq $9, $6, $5
+	brz $9, copy
+	ai $13, $3, 0
+	ai $3, $4, 0
+	ai $4, $13, 0
+	ai $12, $12, -1
+	brnz $12, pass
+	stop 0x2000
@@ -12,38 +12,72 @@
 #include "main.h"
 #include "config.h"
 #include "channel.h"
+#include "stats.h"
+#include "replay.h"
+#include "dirty.h"
 
-static u32 MFC_LSA, MFC_EAH, MFC_EAL, MFC_Size, MFC_TagID, MFC_TagMask, MFC_TagStat;
-
+#define MFC_PUT_CMD 0x20
 #define MFC_GET_CMD 0x40
 #define MFC_SNDSIG_CMD 0xA0
 
+// returns the host copy of size bytes at the current MFC effective
+// address, or NULL if the host did not provide them
+static const u8 *ea_ptr(u32 size)
+{
+	const struct ea_region *r;
+	u64 ea;
+	u32 i;
+
+	if (ctx->ea == NULL)
+		return NULL;
+
+	ea = ((u64)ctx->mfc.eah << 32) | ctx->mfc.eal;
+	for (i = 0; i < ctx->ea->n_regions; i++) {
+		r = &ctx->ea->regions[i];
+		if (ea >= r->ea && ea - r->ea <= r->size && size <= r->size - (ea - r->ea))
+			return r->data + (ea - r->ea);
+	}
+	return NULL;
+}
 
 void handle_mfc_command(u32 cmd)
 {
-	printf("Local address %08x, EA = %08x:%08x, Size=%08x, TagID=%08x, Cmd=%08x\n",
-		MFC_LSA, MFC_EAH, MFC_EAL, MFC_Size, MFC_TagID, cmd);
+	chprintf("Local address %08x, EA = %08x:%08x, Size=%08x, TagID=%08x, Cmd=%08x\n",
+		ctx->mfc.lsa, ctx->mfc.eah, ctx->mfc.eal, ctx->mfc.size, ctx->mfc.tag_id, cmd);
+	stats_dma(cmd, ctx->mfc.size);
 	switch (cmd)
 	{
 	case MFC_GET_CMD:
-		printf("MFC_GET (DMA into LS)\n");
+		chprintf("MFC_GET (DMA into LS)\n");
+		dirty_mark(ctx->mfc.lsa, ctx->mfc.size);
 #if 0
 		{
 			FILE *f = fopen("dma", "rb");
 			if (!f)
 				exit(1);
-			fseek(f, MFC_EAL, SEEK_SET);
-			if (fread(ctx->ls + MFC_LSA, 1, MFC_Size, f) != MFC_Size)
+			fseek(f, ctx->mfc.eal, SEEK_SET);
+			if (fread(ctx->ls + ctx->mfc.lsa, 1, ctx->mfc.size, f) != ctx->mfc.size)
 			{
-				printf("read error\n");
+				chprintf("read error\n");
 				exit(1);
 			}
 			fclose(f);
 		}
 #endif
+		if (replay_mode != REPLAY_OFF)
+			replay_get(ctx->mfc.lsa, ctx->mfc.size);
+		else if (ctx->mfc.size <= LS_SIZE - (ctx->mfc.lsa & LSLR) && ea_ptr(ctx->mfc.size) != NULL)
+			memcpy(ctx->ls + (ctx->mfc.lsa & LSLR), ea_ptr(ctx->mfc.size), ctx->mfc.size);
+		break;
+	case MFC_PUT_CMD:
+		chprintf("MFC_PUT (DMA from LS)\n");
+		if (!lockstep_shadow && ctx->ea != NULL && ctx->ea->put != NULL &&
+		    ctx->mfc.size <= LS_SIZE - (ctx->mfc.lsa & LSLR))
+			ctx->ea->put(ctx->ea, ((u64)ctx->mfc.eah << 32) | ctx->mfc.eal,
+				ctx->ls + (ctx->mfc.lsa & LSLR), ctx->mfc.size);
 		break;
 	default:
-		printf("unknown command\n");
+		chprintf("unknown command\n");
 	}
 }
 
@@ -52,80 +86,84 @@ void handle_mfc_tag_update(u32 tag)
 	switch (tag)
 	{
 	case 0:
-		MFC_TagStat = MFC_TagMask;
+		ctx->mfc.tag_stat = ctx->mfc.tag_mask;
 		break;
 	default:
-		printf("unknown tag update\n");
+		chprintf("unknown tag update\n");
 		break;
 	}
 }
 
 void channel_wrch(int ch, int reg)
 {
-	printf("CHANNEL: wrch ch%d r%d\n", ch, reg);
+	chprintf("CHANNEL: wrch ch%d r%d\n", ch, reg);
+	stats_channel(STATS_WRCH, ch);
 	u32 r = ctx->reg[reg][0];
 	
 	switch (ch)
 	{
 	case 16:
-		printf("MFC_LSA %08x\n", r);
-		MFC_LSA = r;
+		chprintf("MFC_LSA %08x\n", r);
+		ctx->mfc.lsa = r;
 		break;
 	case 17:
-		printf("MFC_EAH %08x\n", r);
-		MFC_EAH = r;
+		chprintf("MFC_EAH %08x\n", r);
+		ctx->mfc.eah = r;
 		break;
 	case 18:
-		printf("MFC_EAL %08x\n", r);
-		MFC_EAL = r;
+		chprintf("MFC_EAL %08x\n", r);
+		ctx->mfc.eal = r;
 		break;
 	case 19:
-		printf("MFC_Size %08x\n", r);
-		MFC_Size = r;
+		chprintf("MFC_Size %08x\n", r);
+		ctx->mfc.size = r;
 		break;
 	case 20:
-		printf("MFC_TagID %08x\n", r);
-		MFC_TagID =r ;
+		chprintf("MFC_TagID %08x\n", r);
+		ctx->mfc.tag_id = r;
 		break;
 	case 21:
-		printf("MFC_Cmd %08x\n", r);
+		chprintf("MFC_Cmd %08x\n", r);
 		handle_mfc_command(r);
 		break;
 	case 22:
-		printf("MFC_WrTagMask %08x\n", r);
-		MFC_TagMask = r;
+		chprintf("MFC_WrTagMask %08x\n", r);
+		ctx->mfc.tag_mask = r;
 		break;
 	case 23:
-		printf("MFC_WrTagUpdate %08x\n", r);
+		chprintf("MFC_WrTagUpdate %08x\n", r);
 		handle_mfc_tag_update(r);
 		break;
 	case 26:
-		printf("MFC_WrListStallAck %08x\n", r);
+		chprintf("MFC_WrListStallAck %08x\n", r);
 		break;
 	case 27:
-		printf("MFC_RdAtomicStat %08x\n", r);
+		chprintf("MFC_RdAtomicStat %08x\n", r);
 		break;
 	default:
-		printf("UNKNOWN CHANNEL\n");
+		chprintf("UNKNOWN CHANNEL\n");
 	}
 }
 
 void channel_rdch(int ch, int reg)
 {
-	printf("CHANNEL: rdch ch%d r%d\n", ch, reg);
+	chprintf("CHANNEL: rdch ch%d r%d\n", ch, reg);
+	stats_channel(STATS_RDCH, ch);
 	u32 r;
 	
 	r = 0;
 	switch (ch)
 	{
 	case 24:
-		r = MFC_TagStat;
-		printf("MFC_RdTagStat %08x\n", r);
+		r = ctx->mfc.tag_stat;
+		chprintf("MFC_RdTagStat %08x\n", r);
 		break;
 	case 27:
-		printf("MFC_RdAtomicStat %08x\n", r);
+		chprintf("MFC_RdAtomicStat %08x\n", r);
 		break;
 	}
+	if (replay_mode != REPLAY_OFF)
+		r = replay_channel(REPLAY_RDCH, ch, r);
 	ctx->reg[reg][0] = r;
 	ctx->reg[reg][1] = 0;
 	ctx->reg[reg][2] = 0;
@@ -136,6 +174,7 @@ int channel_rchcnt(int ch)
 {
 	u32 r;
 	r = 0;
+	stats_channel(STATS_RCHCNT, ch);
 	switch (ch)
 	{
 	case 23:
@@ -143,13 +182,15 @@ int channel_rchcnt(int ch)
 		break;
 	case 24:
 		r = 1;
-		printf("MFC_RdTagStat %08x\n", r);
+		chprintf("MFC_RdTagStat %08x\n", r);
 		break;
 	case 27:
-		printf("MFC_RdAtomicStat %08x\n", r);
+		chprintf("MFC_RdAtomicStat %08x\n", r);
 		break;
 	default:
-		printf("unknown channel %d\n", ch);
+		chprintf("unknown channel %d\n", ch);
 	}
+	if (replay_mode != REPLAY_OFF)
+		r = replay_channel(REPLAY_RCHCNT, ch, r);
 	return r;
 }
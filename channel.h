@@ -5,6 +5,13 @@
 #ifndef CHANNELS_H__
 #define CHANNELS_H__
 
+#include <stdio.h>
+#include "lockstep.h"
+
+// channel and stop output. the engine under test in lockstep runs each
+// block again, only the reference reports it.
+#define chprintf(...) do { if (!lockstep_shadow) printf(__VA_ARGS__); } while (0)
+
 void channel_wrch(int ch, int reg);
 void channel_rdch(int ch, int reg);
 int channel_rchcnt(int ch);
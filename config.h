@@ -21,6 +21,18 @@
 #define	LS_SIZE	256 * 1024
 #define	LSLR	(LS_SIZE - 1)
 #define DUMP_LS_NAME "ls.b"
+#define STATS_NAME "stats.json"
+#define TIMING_NAME "timing.txt"
+#define TRACE_NAME "trace.bin"
+#define COVERAGE_NAME "coverage"
+#define PROFILE_NAME "profile.txt"
+#define PROFILE_PERIOD 1000
+#define SNAPSHOT_NAME "snapshot.bin"
+// stop code that saves a snapshot and continues. spu.py takes a snapshot()
+// for reset() there, a --batch job just stops.
+#define SNAPSHOT_STOP 0x3ffe
+#define BATCH_NAME "results.jsonl"
+#define REVERSE_INTERVAL 1000000
 
 #define SPU_ID 0xdeadbabe
 
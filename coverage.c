@@ -0,0 +1,174 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "elf.h"
+#include "coverage.h"
+
+#define EDGES_INITIAL	1024
+
+int coverage_enabled = 0;
+u32 coverage_map[LS_SIZE / 4 / 32];
+
+// open addressing hash of taken branches; count == 0 marks a free slot
+static struct coverage_edge *edges;
+static u32 edges_size;
+static u32 n_edges;
+
+static u32 edge_hash(u32 from, u32 to)
+{
+	return ((from >> 2) * 0x9e3779b1u) ^ (to >> 2);
+}
+
+static void edges_alloc(u32 size)
+{
+	edges = calloc(size, sizeof *edges);
+	if (edges == NULL)
+		fail("coverage: unable to allocate edge table");
+	edges_size = size;
+	n_edges = 0;
+}
+
+static void edges_grow(void)
+{
+	struct coverage_edge *old = edges;
+	u32 old_size = edges_size;
+	u32 i, h;
+
+	edges_alloc(old_size * 2);
+	for (i = 0; i < old_size; i++) {
+		if (old[i].count == 0)
+			continue;
+		h = edge_hash(old[i].from, old[i].to) & (edges_size - 1);
+		while (edges[h].count != 0)
+			h = (h + 1) & (edges_size - 1);
+		edges[h] = old[i];
+		n_edges++;
+	}
+	free(old);
+}
+
+void coverage_init(void)
+{
+	free(edges);
+	edges_alloc(EDGES_INITIAL);
+	memset(coverage_map, 0, sizeof coverage_map);
+	coverage_enabled = 1;
+}
+
+void coverage_reset(void)
+{
+	memset(coverage_map, 0, sizeof coverage_map);
+	memset(edges, 0, edges_size * sizeof *edges);
+	n_edges = 0;
+}
+
+void coverage_edge(u32 from, u32 to)
+{
+	u32 h;
+
+	h = edge_hash(from, to) & (edges_size - 1);
+	while (edges[h].count != 0) {
+		if (edges[h].from == from && edges[h].to == to) {
+			edges[h].count++;
+			return;
+		}
+		h = (h + 1) & (edges_size - 1);
+	}
+
+	edges[h].from = from;
+	edges[h].to = to;
+	edges[h].count = 1;
+
+	if (++n_edges > edges_size / 2)
+		edges_grow();
+}
+
+// the table has holes; callers skip entries with a zero count
+const struct coverage_edge *coverage_edges(u32 *n)
+{
+	*n = edges_size;
+	return edges;
+}
+
+static u32 coverage_count(u32 addr, u32 size)
+{
+	u32 i, n = 0;
+
+	for (i = addr & ~3; i < addr + size && i < LS_SIZE; i += 4)
+		n += (coverage_map[i >> 7] >> ((i >> 2) & 31)) & 1;
+
+	return n;
+}
+
+static void coverage_report(FILE *fp)
+{
+	const struct elf_sym *syms;
+	u32 n_syms, hit, total, i;
+
+	syms = elf_syms(&n_syms);
+
+	total = coverage_count(0, LS_SIZE);
+	fprintf(fp, "instructions executed: %u\n", total);
+	fprintf(fp, "taken branch edges:    %u\n\n", n_edges);
+
+	fprintf(fp, "%8s %8s %8s %7s  %s\n", "address", "hit", "total", "covered", "function");
+	for (i = 0; i < n_syms; i++) {
+		if (syms[i].size == 0)
+			continue;
+		hit = coverage_count(syms[i].addr, syms[i].size);
+		total = syms[i].size / 4;
+		fprintf(fp, "%08x %8u %8u %6.2f%%  %s\n", syms[i].addr, hit, total,
+				total ? 100.0 * hit / total : 0.0, syms[i].name);
+	}
+
+	fprintf(fp, "\n%8s    %8s %12s\n", "from", "to", "count");
+	for (i = 0; i < edges_size; i++)
+		if (edges[i].count != 0)
+			fprintf(fp, "%08x -> %08x %12llu\n", edges[i].from, edges[i].to, edges[i].count);
+}
+
+// writes prefix.bin (one bit per LS word, least significant bit first) and
+// the per-function report prefix.txt
+void coverage_dump(const char *prefix)
+{
+	char path[1024];
+	u8 bitmap[sizeof coverage_map];
+	FILE *fp;
+	u32 i;
+
+	if (!coverage_enabled)
+		return;
+
+	for (i = 0; i < array_size(coverage_map); i++) {
+		bitmap[i * 4 + 0] = coverage_map[i];
+		bitmap[i * 4 + 1] = coverage_map[i] >> 8;
+		bitmap[i * 4 + 2] = coverage_map[i] >> 16;
+		bitmap[i * 4 + 3] = coverage_map[i] >> 24;
+	}
+
+	snprintf(path, sizeof path, "%s.bin", prefix);
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		perror("coverage: unable to write bitmap");
+		return;
+	}
+	fwrite(bitmap, sizeof bitmap, 1, fp);
+	fclose(fp);
+
+	snprintf(path, sizeof path, "%s.txt", prefix);
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror("coverage: unable to write report");
+		return;
+	}
+	coverage_report(fp);
+	fclose(fp);
+}
@@ -0,0 +1,37 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef COVERAGE_H__
+#define COVERAGE_H__
+
+#include "types.h"
+#include "config.h"
+
+struct coverage_edge {
+	u32 from;
+	u32 to;
+	u64 count;
+};
+
+extern int coverage_enabled;
+extern u32 coverage_map[LS_SIZE / 4 / 32];
+
+void coverage_init(void);
+void coverage_reset(void);
+void coverage_edge(u32 from, u32 to);
+const struct coverage_edge *coverage_edges(u32 *n);
+void coverage_dump(const char *prefix);
+
+static inline void coverage_hit(u32 pc)
+{
+	coverage_map[pc >> 7] |= 1 << ((pc >> 2) & 31);
+}
+
+static inline void coverage_branch(u32 pc, u32 next)
+{
+	if (next != ((pc + 4) & LSLR))
+		coverage_edge(pc, next);
+}
+
+#endif
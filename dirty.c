@@ -0,0 +1,101 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "dirty.h"
+
+// makes the current local store, registers, pc and MFC state the point
+// dirty_reset() returns to
+void dirty_snapshot(void)
+{
+	struct ctx_t *base;
+	u8 *ls;
+
+	if (ctx->base_shared)
+		dirty_free();
+
+	base = ctx->base;
+	if (base == NULL) {
+		base = malloc(sizeof *base);
+		ls = malloc(LS_SIZE);
+		if (base == NULL || ls == NULL)
+			fail("dirty: unable to allocate the reset snapshot");
+	} else {
+		ls = base->ls;
+	}
+
+	*base = *ctx;
+	base->ls = ls;
+	base->base = NULL;
+	memcpy(ls, ctx->ls, LS_SIZE);
+
+	ctx->base = base;
+	ctx->dirty = 0;
+	ctx->ls_gen++;
+}
+
+// like dirty_snapshot(), but dirty_reset() returns to ls instead of a copy
+// of the current local store. the caller keeps ls as it is for as long
+// as the context uses it.
+void dirty_share(const u8 *ls)
+{
+	struct ctx_t *base;
+
+	dirty_free();
+	base = malloc(sizeof *base);
+	if (base == NULL)
+		fail("dirty: unable to allocate the reset snapshot");
+
+	*base = *ctx;
+	base->ls = (u8 *)ls;
+	base->base = NULL;
+
+	ctx->base = base;
+	ctx->base_shared = 1;
+	ctx->dirty = 0;
+}
+
+// copies back the pages written since dirty_snapshot() and the register
+// state, returns the number of pages copied
+u32 dirty_reset(void)
+{
+	struct ctx_t *base;
+	u64 dirty;
+	u32 page, n;
+
+	base = ctx->base;
+	if (base == NULL)
+		fail("dirty: reset without a snapshot");
+
+	n = 0;
+	for (dirty = ctx->dirty, page = 0; dirty != 0; dirty >>= 1, page++) {
+		if ((dirty & 1) == 0)
+			continue;
+		memcpy(ctx->ls + page * DIRTY_PAGE, base->ls + page * DIRTY_PAGE, DIRTY_PAGE);
+		n++;
+	}
+
+	memcpy(ctx->reg, base->reg, sizeof ctx->reg);
+	ctx->pc = base->pc;
+	ctx->mfc = base->mfc;
+	ctx->dirty = 0;
+	ctx->ls_gen++;
+	return n;
+}
+
+void dirty_free(void)
+{
+	if (ctx->base == NULL)
+		return;
+	if (!ctx->base_shared)
+		free(ctx->base->ls);
+	free(ctx->base);
+	ctx->base = NULL;
+	ctx->base_shared = 0;
+}
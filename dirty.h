@@ -0,0 +1,48 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef DIRTY_H__
+#define DIRTY_H__
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "reverse.h"
+
+// ctx->dirty has one bit per 4KB local store page written since the last
+// dirty_snapshot(). every write to the local store goes through
+// dirty_mark() first, which also saves the page for reverse execution.
+// ctx->ls_gen changes whenever bits of ctx->dirty are dropped or the
+// local store is written behind dirty_mark()'s back, as long as it stays
+// the same a page without its bit set hasn't been written.
+#define DIRTY_PAGE_SHIFT	12
+#define DIRTY_PAGE		(1 << DIRTY_PAGE_SHIFT)
+
+void dirty_snapshot(void);
+void dirty_share(const u8 *ls);
+u32 dirty_reset(void);
+void dirty_free(void);
+
+static inline void dirty_mark(u32 addr, u32 len)
+{
+	u32 first, last;
+	u64 pages;
+
+	if (len == 0)
+		return;
+
+	addr &= LSLR;
+	first = addr >> DIRTY_PAGE_SHIFT;
+	if (len > LS_SIZE - addr)
+		last = 63;
+	else
+		last = (addr + len - 1) >> DIRTY_PAGE_SHIFT;
+
+	pages = (~0ULL >> (63 - last)) & (~0ULL << first);
+	if (reverse_enabled && (pages & ~reverse_saved) != 0)
+		reverse_save(pages & ~reverse_saved);
+	ctx->dirty |= pages;
+}
+
+#endif
@@ -0,0 +1,96 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "types.h"
+#include "emulate-instrs.h"
+#include "disasm.h"
+
+#define bits(start, end) ((instr >> (31 - (end))) & ((1 << ((end) - (start) + 1)) - 1))
+
+// the immediate field of each format
+static u32 immediate(u32 instr, u32 type, u32 flags)
+{
+	switch (type) {
+		case SPU_INSTR_RI7:
+			return flags & INSTR_SIGNED ? se7(bits(11, 17)) : bits(11, 17);
+		case SPU_INSTR_RI10:
+			return flags & INSTR_SIGNED ? se10(bits(8, 17)) : bits(8, 17);
+		case SPU_INSTR_RI16:
+			return flags & INSTR_SIGNED ? se16(bits(9, 24)) : bits(9, 24);
+		case SPU_INSTR_RI18:
+			return bits(7, 24);
+		default:
+			return 0;
+	}
+}
+
+// one operand of the list in instr_tbl
+static int operand(char *bfr, u32 size, const char *op, u32 len, u32 pc, u32 instr)
+{
+	u32 o = bits(0, 10);
+	u32 type = instr_tbl[o].type;
+	u32 flags = instr_tbl[o].flags;
+	u32 i = immediate(instr, type, flags);
+	u32 ro;
+
+#define is(s) (len == strlen(s) && memcmp(op, s, len) == 0)
+	if (is("rt"))
+		return snprintf(bfr, size, "$%u", type == SPU_INSTR_RRR ? bits(4, 10) : bits(25, 31));
+	if (is("ra"))
+		return snprintf(bfr, size, "$%u", bits(18, 24));
+	if (is("rb"))
+		return snprintf(bfr, size, "$%u", bits(11, 17));
+	if (is("rc"))
+		return snprintf(bfr, size, "$%u", bits(25, 31));
+	if (is("ca"))
+		return snprintf(bfr, size, "$ch%u", bits(18, 24));
+	if (is("sa"))
+		return snprintf(bfr, size, "$sp%u", bits(18, 24));
+	if (is("code"))
+		return snprintf(bfr, size, "0x%x", instr & 0x3fff);
+	if (is("i"))
+		return snprintf(bfr, size, flags & INSTR_SIGNED ? "%d" : "0x%x", (int)i);
+	// d-form loads and stores count quadwords
+	if (is("i(ra)"))
+		return snprintf(bfr, size, "%d($%u)", (int)(type == SPU_INSTR_RI10 ? i << 4 : i), bits(18, 24));
+	if (is("abs"))
+		return snprintf(bfr, size, "0x%x", (bits(9, 24) << 2) & LSLR);
+	if (is("rel"))
+		return snprintf(bfr, size, "0x%x", (pc + (se16(bits(9, 24)) << 2)) & LSLR);
+	if (is("brinst")) {
+		if (type == SPU_INSTR_RI18)
+			ro = (bits(7, 8) << 7) | bits(25, 31);
+		else
+			ro = (bits(16, 17) << 7) | bits(25, 31);
+		return snprintf(bfr, size, "0x%x", (pc + (se(ro, 9) << 2)) & LSLR);
+	}
+#undef is
+	return snprintf(bfr, size, "?");
+}
+
+int disasm(u32 pc, u32 instr, char *bfr, u32 size)
+{
+	char text[128];
+	const char *ops, *end;
+	u32 o, n;
+
+	o = bits(0, 10);
+	if (instr_tbl[o].name == NULL)
+		return snprintf(bfr, size, ".long 0x%08x", instr);
+
+	// operands are short, there is always room for them
+	n = sprintf(text, "%s", instr_tbl[o].name);
+	for (ops = instr_tbl[o].operands; *ops != 0; ops = *end ? end + 1 : end) {
+		end = strchr(ops, ',');
+		if (end == NULL)
+			end = ops + strlen(ops);
+		text[n++] = ops == instr_tbl[o].operands ? ' ' : ',';
+		n += operand(text + n, sizeof text - n, ops, end - ops, pc, instr);
+	}
+	return snprintf(bfr, size, "%s", text);
+}
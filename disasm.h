@@ -0,0 +1,14 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef DISASM_H__
+#define DISASM_H__
+
+#include "types.h"
+
+// writes instr at pc in assembler syntax ("lqd $3,16($1)", branch targets
+// as local store addresses) to bfr. returns what snprintf() would.
+int disasm(u32 pc, u32 instr, char *bfr, u32 size);
+
+#endif
@@ -3,26 +3,52 @@
 // http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "config.h"
 #include "types.h"
 #include "elf.h"
 #include "main.h"
+#include "image.h"
+
+#define SHT_SYMTAB	2
+#define STT_NOTYPE	0
+#define STT_FUNC	2
 
 static const char elf_magic[] = {0x7f, 'E', 'L', 'F'};
-static FILE *fp;
-static u32 phdr_offset;
-static u32 n_phdrs;
 
-static void elf_load_phdr(u32 i)
+// the file elf_parse() works on
+static const char *elf_name;
+static const u8 *elf;
+static u32 elf_size;
+static int elf_bad;
+
+// symbols of the program last loaded with elf_load()
+static const struct elf_sym *syms;
+static u32 n_syms;
+
+// returns len bytes at offset of the file, NULL if it is too short (fail()
+// returns in the python module)
+static u8 *elf_at(u32 offset, u32 len)
 {
-	u8 phdr[0x20];
+	if (offset > elf_size || len > elf_size - offset) {
+		elf_bad = 1;
+		fail("%s: truncated ELF, no %u bytes at 0x%x", elf_name, len, offset);
+		return NULL;
+	}
+	return (u8 *)elf + offset;
+}
+
+static void elf_load_phdr(struct image *img, u32 phdr_offset, u32 i)
+{
+	u8 *phdr, *data;
 	u32 offset;
 	u32 paddr;
 	u32 size;
 
-	fseek(fp, phdr_offset + 0x20 * i, SEEK_SET);
-	fread(phdr, sizeof phdr, 1, fp);
+	phdr = elf_at(phdr_offset + 0x20 * i, 0x20);
+	if (phdr == NULL)
+		return;
 
 	if (be32(phdr) != 1) {
 		dbgprintf("phdr #%u: no LOAD\n", i);
@@ -34,37 +60,214 @@ static void elf_load_phdr(u32 i)
 	size = be32(phdr + 0x10);
 	dbgprintf("elf: phdr #%u: %08x bytes; %08x -> %08x\n", i, size, offset, paddr);
 
-	// XXX: integer overflow
-	if (offset > LS_SIZE || (offset + size) > LS_SIZE)
+	if (paddr > LS_SIZE || size > LS_SIZE - paddr) {
+		elf_bad = 1;
 		fail("phdr exceeds local storage");
+		return;
+	}
 
-	fseek(fp, offset, SEEK_SET);
-	fread(ctx->ls + paddr, size, 1, fp);
+	data = elf_at(offset, size);
+	if (data == NULL)
+		return;
+	memcpy(img->ls + paddr, data, size);
+	img->segs[img->n_segs].addr = paddr;
+	img->segs[img->n_segs].size = size;
+	img->n_segs++;
 }
 
-void elf_load(const char *path)
+static int elf_sym_cmp(const void *a, const void *b)
+{
+	const struct elf_sym *x = a;
+	const struct elf_sym *y = b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return 0;
+}
+
+static void elf_load_symtab(struct image *img, u32 shdr_offset, u8 *shdr)
+{
+	struct elf_sym *s;
+	u8 *strtab_shdr;
+	u8 *sym;
+	char *strtab;
+	u32 str_offset, str_size;
+	u32 offset, count;
+	u32 name, len;
+	u32 i;
+
+	offset = be32(shdr + 0x10);
+	count = be32(shdr + 0x14) / 0x10;
+
+	strtab_shdr = elf_at(shdr_offset + 0x28 * be32(shdr + 0x18), 0x28);
+	if (strtab_shdr == NULL)
+		return;
+	str_offset = be32(strtab_shdr + 0x10);
+	str_size = be32(strtab_shdr + 0x14);
+	strtab = (char *)elf_at(str_offset, str_size);
+	if (strtab == NULL)
+		return;
+
+	img->syms = malloc((count ? count : 1) * sizeof *img->syms);
+	if (img->syms == NULL) {
+		elf_bad = 1;
+		fail("Unable to allocate symbol table");
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		sym = elf_at(offset + 0x10 * i, 0x10);
+		if (sym == NULL)
+			break;
+
+		name = be32(sym);
+		if (name == 0 || name >= str_size || be16(sym + 0x0e) == 0)
+			continue;
+		if ((sym[0x0c] & 0xf) != STT_FUNC && (sym[0x0c] & 0xf) != STT_NOTYPE)
+			continue;
+
+		for (len = 0; name + len < str_size && strtab[name + len]; len++)
+			;
+		s = &img->syms[img->n_syms++];
+		s->addr = be32(sym + 0x04) & LSLR;
+		s->size = be32(sym + 0x08);
+		s->name = malloc(len + 1);
+		if (s->name == NULL) {
+			img->n_syms--;
+			elf_bad = 1;
+			fail("Unable to allocate symbol table");
+			break;
+		}
+		memcpy(s->name, strtab + name, len);
+		s->name[len] = 0;
+	}
+
+	qsort(img->syms, img->n_syms, sizeof *img->syms, elf_sym_cmp);
+	dbgprintf("elf: loaded %u symbols\n", img->n_syms);
+}
+
+static void elf_load_symbols(struct image *img, u32 shdr_offset, u32 n_shdrs)
 {
-	u8 ehdr[0x34];
+	u8 *shdr;
 	u32 i;
 
-	fp = fopen(path, "rb");
-	if (fp == NULL)
-		fail("Unable to load elf");
+	for (i = 0; i < n_shdrs; i++) {
+		shdr = elf_at(shdr_offset + 0x28 * i, 0x28);
+		if (shdr == NULL)
+			return;
 
-	fread(ehdr, sizeof ehdr, 1, fp);
-	if (memcmp(ehdr, elf_magic, 4))
+		if (be32(shdr + 0x04) == SHT_SYMTAB) {
+			elf_load_symtab(img, shdr_offset, shdr);
+			return;
+		}
+	}
+}
+
+// loads the ELF file in memory at data into img, whose local store starts
+// out zeroed. returns -1 if the file is broken. not reentrant,
+// image_get() is the only caller.
+int elf_parse(const char *path, const u8 *data, u32 size, struct image *img)
+{
+	u8 *ehdr;
+	u32 phdr_offset, n_phdrs;
+	u32 shdr_offset, n_shdrs;
+	u32 i;
+
+	elf_name = path;
+	elf = data;
+	elf_size = size;
+	elf_bad = 0;
+
+	ehdr = elf_at(0, 0x34);
+	if (ehdr == NULL || memcmp(ehdr, elf_magic, 4)) {
 		fail("not a ELF file");
+		return -1;
+	}
 
 	phdr_offset = be32(ehdr + 0x1c);
 	n_phdrs = be16(ehdr + 0x2c);
+	shdr_offset = be32(ehdr + 0x20);
+	n_shdrs = be16(ehdr + 0x30);
 
 	dbgprintf("elf: %u phdrs at offset 0x%08x\n", n_phdrs, phdr_offset);
 
+	img->segs = malloc((n_phdrs ? n_phdrs : 1) * sizeof *img->segs);
+	if (img->segs == NULL) {
+		fail("Unable to allocate segment table");
+		return -1;
+	}
 	for (i = 0; i < n_phdrs; i++)
-		elf_load_phdr(i);
+		elf_load_phdr(img, phdr_offset, i);
 
-	ctx->pc = be32(ehdr + 0x18);
-	dbgprintf("elf: entry is at %08x\n", ctx->pc);
+	elf_load_symbols(img, shdr_offset, n_shdrs);
 
-	fclose(fp);
+	img->entry = be32(ehdr + 0x18);
+	dbgprintf("elf: entry is at %08x\n", img->entry);
+
+	elf = NULL;
+	return elf_bad ? -1 : 0;
+}
+
+// copies the segments of the (cached) program at path into the local store
+// and makes its symbols current
+void elf_load(const char *path)
+{
+	const struct image *img;
+	u32 i;
+
+	img = image_get(path);
+	if (img == NULL)
+		return;
+	for (i = 0; i < img->n_segs; i++)
+		memcpy(ctx->ls + img->segs[i].addr, img->ls + img->segs[i].addr, img->segs[i].size);
+	ctx->ls_gen++;
+
+	syms = img->syms;
+	n_syms = img->n_syms;
+	ctx->pc = img->entry;
+}
+
+const struct elf_sym *elf_sym_by_name(const char *name)
+{
+	u32 i;
+
+	for (i = 0; i < n_syms; i++)
+		if (strcmp(syms[i].name, name) == 0)
+			return &syms[i];
+
+	return NULL;
+}
+
+// returns the symbol covering addr, or the closest one below it if the
+// symbol has no size
+const struct elf_sym *elf_sym_by_addr(u32 addr)
+{
+	u32 lo, hi, mid;
+	const struct elf_sym *s;
+
+	lo = 0;
+	hi = n_syms;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (syms[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		return NULL;
+
+	s = &syms[lo - 1];
+	if (s->size != 0 && addr >= s->addr + s->size)
+		return NULL;
+
+	return s;
+}
+
+// all symbols, sorted by address
+const struct elf_sym *elf_syms(u32 *n)
+{
+	*n = n_syms;
+	return syms;
 }
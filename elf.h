@@ -7,6 +7,19 @@
 
 #include "types.h"
 
+struct elf_sym {
+	u32 addr;
+	u32 size;
+	char *name;
+};
+
+struct image;
+
 void elf_load(const char *path);
+int elf_parse(const char *path, const u8 *elf, u32 size, struct image *img);
+
+const struct elf_sym *elf_sym_by_name(const char *name);
+const struct elf_sym *elf_sym_by_addr(u32 addr);
+const struct elf_sym *elf_syms(u32 *n);
 
 #endif
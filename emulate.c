@@ -11,15 +11,23 @@
 #include "emulate-instrs.h"
 #include "helper.h"
 #include "gdb.h"
-
-static u32 instr;
-
-static u32 op;
-static u32 ra;
-static u32 rb;
-static u32 rc;
-static u32 rt;
-static u32 ix;
+#include "hook.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
+#include "coverage.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "reverse.h"
+
+static __thread u32 instr;
+
+static __thread u32 op;
+static __thread u32 ra;
+static __thread u32 rb;
+static __thread u32 rc;
+static __thread u32 rt;
+static __thread u32 ix;
 
 #define instr_bits(start, end) (instr >> (31 - end)) & ((1 << (end - start + 1)) - 1)
 
@@ -123,11 +131,47 @@ u32 emulate(void)
 		return 0;
 	}
 
+	if (ctx->pc == snapshot_at) {
+		snapshot_save(snapshot_path, ctx->pc);
+		snapshot_at = ~0;
+	}
+
+	if (reverse_enabled)
+		reverse_step();
+
+	// not traced, see trace.h
+	if (hook_check(ctx->pc)) {
+		if (stats_enabled)
+			stats.hooks++;
+		return hook_run(ctx->pc);
+	}
+
 #ifdef DEBUG_TRACE
 	dbgprintf("%05x: %08x (r1=%08x) ", ctx->pc, instr, ctx->reg[1][0]);
 #endif
 
+	if (trace_enabled) {
+		if (instr_tbl[instr_bits(0, 10)].type == SPU_INSTR_RRR)
+			trace_before(instr_bits(4, 10));
+		else
+			trace_before(instr_bits(25, 31));
+	}
+
 	res = emulate_instr();
+	if (res == 2) {
+		// a watchpoint stopped the access, the instruction didn't
+		// retire and runs again
+		if (reverse_enabled)
+			reverse_count--;
+		return res;
+	}
+	ctx->instrs++;
+	if (stats_enabled)
+		stats.instrs[op]++;
+	if (trace_enabled)
+		trace_after(opc, instr);
+	if (coverage_enabled)
+		coverage_hit(opc);
 	if (res != 0)
 		return res;
 
@@ -177,6 +221,28 @@ u32 emulate(void)
 	if ((ctx->pc & 3) != 0)
 		fail("pc is not aligned: %08x", ctx->pc);
 
+	if (timing_enabled)
+		timing_retire(opc, instr, op);
+	if (coverage_enabled)
+		coverage_branch(opc, ctx->pc);
+	if (profile_enabled)
+		profile_retire(opc, instr, op);
+
 //	dbgprintf("\n\n", count);
 	return 0;
 }
+
+u32 emulate_block(void)
+{
+	u32 pc, res;
+	int branch;
+
+	do {
+		pc = ctx->pc;
+		branch = instr_tbl[be32(ctx->ls + pc) >> 21].flags & INSTR_BRANCH;
+		res = emulate();
+	} while (res == 0 && ctx->paused == 0 && !branch &&
+		 ctx->pc == ((pc + 4) & LSLR));
+
+	return res;
+}
@@ -8,6 +8,18 @@
 #include "types.h"
 
 u32 emulate(void);
+u32 emulate_block(void);
+
+enum spu_instr_type {
+	SPU_INSTR_RR,
+	SPU_INSTR_RRR,
+	SPU_INSTR_RI7,
+	SPU_INSTR_RI10,
+	SPU_INSTR_RI16,
+	SPU_INSTR_RI18,
+	SPU_INSTR_SPECIAL,
+	SPU_INSTR_NONE
+};
 
 typedef int (*spu_instr_rr_t)(u32 ra, u32 rb, u32 rt);
 typedef int (*spu_instr_rrr_t)(u32 ra, u32 rb, u32 rc, u32 rt);
@@ -0,0 +1,47 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <string.h>
+
+#include "config.h"
+#include "types.h"
+#include "emulate.h"
+#include "engine.h"
+#include "gdb.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
+#include "coverage.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "reverse.h"
+
+// the instrs handlers through emulate_instr, the reference for all others
+const struct engine engine_interp = {"interp", emulate_block};
+
+const struct engine *engines[] = {
+	&engine_interp,
+	&engine_fuse,
+	&engine_aot,
+	NULL
+};
+
+const struct engine *engine_find(const char *name)
+{
+	u32 i;
+
+	for (i = 0; engines[i] != NULL; i++)
+		if (strcmp(engines[i]->name, name) == 0)
+			return engines[i];
+	return NULL;
+}
+
+// whether something watches single instructions. engines other than
+// interp run emulate_block() then.
+int engine_watched(void)
+{
+	return gdb_active() || reverse_enabled || snapshot_at != ~0U ||
+	       stats_enabled || trace_enabled || timing_enabled ||
+	       coverage_enabled || profile_enabled;
+}
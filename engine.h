@@ -0,0 +1,26 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef ENGINE_H__
+#define ENGINE_H__
+
+#include "types.h"
+
+// an execution engine runs ctx up to and including the next branch (a
+// block boundary) and returns like emulate(). it may stop earlier when
+// emulate() would, or when gdb pauses the context.
+struct engine {
+	const char *name;
+	u32 (*block)(void);
+};
+
+extern const struct engine engine_interp;
+extern const struct engine engine_fuse;
+extern const struct engine engine_aot;
+extern const struct engine *engines[];
+
+const struct engine *engine_find(const char *name);
+int engine_watched(void);
+
+#endif
@@ -0,0 +1,388 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "emulate.h"
+#include "emulate-instrs.h"
+#include "engine.h"
+#include "helper.h"
+#include "dirty.h"
+#include "lockstep.h"
+#include "hook.h"
+
+// the fuse engine decodes every instruction once into a per thread cache
+// with one entry per local store word, and replaces the idioms SPU
+// compilers emit with a single handler:
+//
+//   ilhu rt,hi; iohl rt,lo				32 bit constant
+//   lqd l,o(p); rotqby(i) r,l,q			scalar load
+//   lqd l,o(p); cwd m,c(q); shufb r,v,l,m; stqd r,o(p)	scalar store
+//   c{eq,gt,lgt}[i] rt,...; br[n]z rt,target		compare and branch
+//
+// the scalar load and store skip writing the loaded quadword when the
+// idiom overwrites it anyway, and the store writes the one word that
+// changes instead of shuffling all 16 bytes.
+//
+// an entry holds the word it was decoded from and is decoded again when
+// the local store differs. a fused entry also checks the words after it,
+// and decoding a word again drops the fused entries that cover it.
+enum {
+	FUSE_NONE,
+	FUSE_INSTR,
+	FUSE_CONST,
+	FUSE_LOAD,
+	FUSE_STORE,
+	FUSE_CMP_BRANCH
+};
+
+#define FUSE_MAX	4
+
+// FUSE_INSTR and the compare of FUSE_CMP_BRANCH: r is rt, ra, rb, rc and
+// imm[0] the immediate as the handler takes it.
+// FUSE_CONST: r[0] rt, imm[0] the value.
+// FUSE_LOAD: r is r, l, p, q, imm is o, the rotqbyi shift. r[4] is set
+// for rotqbyi.
+// FUSE_STORE: r is l, p, m, q, v, r, imm is o, c.
+// FUSE_CMP_BRANCH: r[4] is set for brnz, imm[1] is the branch offset.
+struct fuse_op {
+	u32 word;
+	u8 kind;
+	u8 n;			// instructions it covers, 0 before matching
+	u8 type;
+	u8 branch;
+	u8 r[6];
+	u32 imm[2];
+	void *fn;
+};
+
+static __thread struct fuse_op *cache;
+
+static int fuse_instr(const struct fuse_op *e)
+{
+	switch (e->type) {
+	case SPU_INSTR_RR:
+		return ((spu_instr_rr_t)e->fn)(e->r[0], e->r[1], e->r[2]);
+	case SPU_INSTR_RRR:
+		return ((spu_instr_rrr_t)e->fn)(e->r[0], e->r[1], e->r[2], e->r[3]);
+	case SPU_INSTR_RI7:
+		return ((spu_instr_ri7_t)e->fn)(e->r[0], e->r[1], e->imm[0]);
+	case SPU_INSTR_RI10:
+		return ((spu_instr_ri10_t)e->fn)(e->r[0], e->r[1], e->imm[0]);
+	case SPU_INSTR_RI16:
+		return ((spu_instr_ri16_t)e->fn)(e->r[0], e->imm[0]);
+	case SPU_INSTR_RI18:
+		return ((spu_instr_ri18_t)e->fn)(e->r[0], e->imm[0]);
+	case SPU_INSTR_SPECIAL:
+		return ((spu_instr_special_t)e->fn)(e->word);
+	default:
+		fail("Unknown instruction at %08x: %08x", ctx->pc, e->word);
+		return 1;
+	}
+}
+
+#define bits(w, start, end) (((w) >> (31 - (end))) & ((1 << ((end) - (start) + 1)) - 1))
+
+static void fuse_decode_instr(u32 i, u32 w)
+{
+	struct fuse_op *e = &cache[i];
+	u32 op = w >> 21;
+	u32 k;
+
+	// fused entries before this one may have been decoded from the old word
+	if (e->kind != FUSE_NONE && e->word != w)
+		for (k = 1; k < FUSE_MAX && k <= i; k++)
+			if (cache[i - k].n > k)
+				cache[i - k].n = 0;
+
+	e->word = w;
+	e->kind = FUSE_INSTR;
+	e->n = 1;
+	e->type = instr_tbl[op].type;
+	e->branch = (instr_tbl[op].flags & INSTR_BRANCH) != 0;
+	e->fn = instr_tbl[op].ptr;
+	e->imm[0] = e->imm[1] = 0;
+
+	switch (e->type) {
+	case SPU_INSTR_RRR:
+		e->r[0] = bits(w, 4, 10);
+		e->r[1] = bits(w, 18, 24);
+		e->r[2] = bits(w, 11, 17);
+		e->r[3] = bits(w, 25, 31);
+		break;
+	case SPU_INSTR_RI7:
+		e->imm[0] = bits(w, 11, 17);
+		goto ra;
+	case SPU_INSTR_RI10:
+		e->imm[0] = bits(w, 8, 17);
+		goto ra;
+	case SPU_INSTR_RI16:
+		e->imm[0] = bits(w, 9, 24);
+		goto rt;
+	case SPU_INSTR_RI18:
+		e->imm[0] = bits(w, 7, 24);
+		goto rt;
+	default:
+		e->r[2] = bits(w, 11, 17);
+	ra:
+		e->r[1] = bits(w, 18, 24);
+	rt:
+		e->r[0] = bits(w, 25, 31);
+		break;
+	}
+}
+
+static int fuse_is(const struct fuse_op *e, void *fn)
+{
+	return e->fn == fn;
+}
+
+static int fuse_is_cmp(const struct fuse_op *e)
+{
+	return fuse_is(e, instr_ceq) || fuse_is(e, instr_ceqi) ||
+	       fuse_is(e, instr_cgt) || fuse_is(e, instr_cgti) ||
+	       fuse_is(e, instr_clgt) || fuse_is(e, instr_clgti);
+}
+
+// the idiom starting at e, n words long, if there is one
+static u32 fuse_match(struct fuse_op *e, u32 n)
+{
+	struct fuse_op *a = e, *b = e + 1, *c = e + 2, *d = e + 3;
+	u8 l, p, m, q, v;
+
+	if (n >= 2 && fuse_is(a, instr_ilhu) && fuse_is(b, instr_iohl) &&
+	    a->r[0] == b->r[0]) {
+		e->kind = FUSE_CONST;
+		e->imm[0] = (a->imm[0] << 16) | b->imm[0];
+		return 2;
+	}
+
+	if (n >= 2 && fuse_is_cmp(a) &&
+	    (fuse_is(b, instr_brz) || fuse_is(b, instr_brnz)) &&
+	    a->r[0] == b->r[0]) {
+		e->r[4] = fuse_is(b, instr_brnz);
+		e->imm[1] = se16(b->imm[0]) << 2;
+		e->kind = FUSE_CMP_BRANCH;
+		return 2;
+	}
+
+	if (n < 2 || !fuse_is(a, instr_lqd))
+		return 1;
+	l = a->r[0];
+	p = a->r[1];
+
+	if (fuse_is(b, instr_rotqby) || fuse_is(b, instr_rotqbyi)) {
+		// the shift has to come from before the load
+		if (b->r[1] != l || (fuse_is(b, instr_rotqby) && b->r[2] == l))
+			return 1;
+		e->r[4] = fuse_is(b, instr_rotqbyi);
+		e->r[3] = b->r[2];
+		e->imm[1] = b->imm[0];
+		e->r[0] = b->r[0];
+		e->r[1] = l;
+		e->r[2] = p;
+		e->imm[0] = se10(a->imm[0]) << 4;
+		e->kind = FUSE_LOAD;
+		return 2;
+	}
+
+	if (n < 4 || !fuse_is(b, instr_cwd) || !fuse_is(c, instr_shufb) ||
+	    !fuse_is(d, instr_stqd))
+		return 1;
+	m = b->r[0];
+	q = b->r[1];
+	v = c->r[1];
+	// shufb v,l,m into the register stqd writes back to the same address,
+	// with nothing in between changing what the others read
+	if (c->r[2] != l || c->r[3] != m || d->r[0] != c->r[0] ||
+	    d->r[1] != p || d->imm[0] != a->imm[0])
+		return 1;
+	if (m == l || q == l || v == l || v == m ||
+	    p == l || p == m || p == c->r[0])
+		return 1;
+	e->r[5] = c->r[0];
+	e->r[4] = v;
+	e->r[3] = q;
+	e->r[2] = m;
+	e->imm[1] = b->imm[0];
+	e->r[0] = l;
+	e->r[1] = p;
+	e->imm[0] = se10(a->imm[0]) << 4;
+	e->kind = FUSE_STORE;
+	return 4;
+}
+
+static int fuse_hooked(u32 pc, u32 n)
+{
+	u32 i;
+
+	for (i = 1; i < n; i++)
+		if (hook_check(pc + i * 4))
+			return 1;
+	return 0;
+}
+
+static struct fuse_op *fuse_decode(u32 pc)
+{
+	struct fuse_op *e;
+	u32 i = pc >> 2, n, k, w;
+
+	// an idiom doesn't wrap around the end of the local store or run past
+	// a branch
+	for (n = 0; n < FUSE_MAX && i + n < LS_SIZE / 4; n++) {
+		w = be32(ctx->ls + pc + n * 4);
+		// the start of an idiom doesn't have the instruction's fields.
+		// the ones decoded here only to look at are matched when they
+		// run themselves.
+		if (n == 0 || cache[i + n].kind != FUSE_INSTR ||
+		    cache[i + n].word != w) {
+			fuse_decode_instr(i + n, w);
+			if (n > 0)
+				cache[i + n].n = 0;
+		}
+		if (cache[i + n].branch) {
+			n++;
+			break;
+		}
+	}
+
+	e = &cache[i];
+	k = fuse_match(e, n);
+	if (k > 1 && fuse_hooked(pc, k))
+		fuse_decode_instr(i, e->word);
+	else
+		e->n = k;
+	return e;
+}
+
+static int fuse_valid(const struct fuse_op *e, u32 pc)
+{
+	u32 i;
+
+	if (e->n == 0 || e->word != be32(ctx->ls + pc))
+		return 0;
+	for (i = 1; i < e->n; i++)
+		if (e[i].word != be32(ctx->ls + pc + i * 4) ||
+		    hook_check(pc + i * 4))
+			return 0;
+	return 1;
+}
+
+static void fuse_load(const struct fuse_op *e)
+{
+	u32 addr, shift, q[4];
+	u8 b[16];
+	int i;
+
+	addr = (ctx->reg[e->r[2]][0] + e->imm[0]) & LSLR & 0xfffffff0;
+	shift = (e->r[4] ? e->imm[1] : ctx->reg[e->r[3]][0]) & 15;
+	if (e->r[1] != e->r[0])
+		ls2reg(e->r[1], addr);
+
+	if ((shift & 3) == 0) {
+		for (i = 0; i < 4; i++)
+			q[i] = be32(ctx->ls + addr + 4 * ((i + shift / 4) & 3));
+		for (i = 0; i < 4; i++)
+			ctx->reg[e->r[0]][i] = q[i];
+	} else {
+		for (i = 0; i < 16; i++)
+			b[i] = ctx->ls[addr + ((i + shift) & 15)];
+		byte_to_reg(e->r[0], b);
+	}
+}
+
+static void fuse_store(const struct fuse_op *e)
+{
+	u32 addr, t, v, q[4];
+	int i;
+
+	addr = (ctx->reg[e->r[1]][0] + e->imm[0]) & LSLR & 0xfffffff0;
+	t = ((ctx->reg[e->r[3]][0] + e->imm[1]) >> 2) & 3;
+	v = ctx->reg[e->r[4]][0];
+
+	for (i = 0; i < 4; i++)
+		q[i] = be32(ctx->ls + addr + i * 4);
+	if (e->r[0] != e->r[5])
+		for (i = 0; i < 4; i++)
+			ctx->reg[e->r[0]][i] = q[i];
+	for (i = 0; i < 4; i++)
+		ctx->reg[e->r[2]][i] = (i == (int)t) ? 0x00010203 : (0x01010101 * (i * 4) + 0x10111213);
+	q[t] = v;
+	for (i = 0; i < 4; i++)
+		ctx->reg[e->r[5]][i] = q[i];
+
+	lockstep_store(addr);
+	dirty_mark(addr, 16);
+	wbe32(ctx->ls + addr + t * 4, v);
+}
+
+static u32 fuse_block(void)
+{
+	struct fuse_op *e;
+	u32 pc, res;
+	int i;
+
+	if (engine_watched())
+		return emulate_block();
+
+	if (cache == NULL) {
+		cache = calloc(LS_SIZE / 4, sizeof *cache);
+		if (cache == NULL) {
+			fail("fuse: unable to allocate the decode cache");
+			return 1;
+		}
+	}
+
+	do {
+		pc = ctx->pc;
+		if (hook_check(pc))
+			return emulate();
+
+		e = &cache[pc >> 2];
+		if (!fuse_valid(e, pc))
+			e = fuse_decode(pc);
+
+		switch (e->kind) {
+		case FUSE_CONST:
+			for (i = 0; i < 4; i++)
+				ctx->reg[e->r[0]][i] = e->imm[0];
+			break;
+		case FUSE_LOAD:
+			fuse_load(e);
+			break;
+		case FUSE_STORE:
+			fuse_store(e);
+			break;
+		case FUSE_CMP_BRANCH:
+			fuse_instr(e);
+			ctx->instrs += 2;
+			if ((ctx->reg[e->r[0]][0] != 0) == e->r[4])
+				ctx->pc = (pc + 4 + e->imm[1]) & LSLR;
+			else
+				ctx->pc = (pc + 8) & LSLR;
+			return 0;
+		default:
+			res = fuse_instr(e);
+			ctx->instrs++;
+			if (res != 0)
+				return res;
+			ctx->pc = (ctx->pc + 4) & LSLR;
+			if ((ctx->pc & 3) != 0)
+				fail("pc is not aligned: %08x", ctx->pc);
+			if (e->branch || ctx->pc != ((pc + 4) & LSLR))
+				return 0;
+			continue;
+		}
+
+		ctx->instrs += e->n;
+		ctx->pc = (pc + e->n * 4) & LSLR;
+	} while (ctx->paused == 0);
+
+	return 0;
+}
+
+const struct engine engine_fuse = {"fuse", fuse_block};
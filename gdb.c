@@ -7,10 +7,17 @@
 #include "types.h"
 #include "gdb.h"
 #include "main.h"
+#include "emulate.h"
+#include "snapshot.h"
+#include "dirty.h"
+#include "agent.h"
+#include "reverse.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <unistd.h>
 #ifdef _WIN32
 #include <ws2tcpip.h>
@@ -22,6 +29,8 @@
 #include <netinet/in.h>
 #endif
 #include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
 
 
 #undef dbgprintf
@@ -31,13 +40,20 @@
 #define dbgprintf printf
 #endif
 
-#define		GDB_BFR_MAX	10000
+// large enough for the whole local store in hex in one packet
+#define		GDB_BFR_MAX	(2 * LS_SIZE + 0x100)
+#define		GDB_PACKET_SIZE	(GDB_BFR_MAX - 0x10)
+#define		GDB_RX_MAX	0x4000
 #define		GDB_MAX_BP	10
+#define		GDB_MAX_COND	8
+#define		GDB_MAX_THREADS	256
 
 #define		GDB_STUB_START	'$'
 #define		GDB_STUB_END	'#'
 #define		GDB_STUB_ACK	'+'
 #define		GDB_STUB_NAK	'-'
+#define		GDB_STUB_ESC	'}'
+#define		GDB_STUB_BREAK	0x03
 
 static int sock = -1;
 static struct sockaddr_in saddr_server, saddr_client;
@@ -45,19 +61,94 @@ static struct sockaddr_in saddr_server, saddr_client;
 static u8 cmd_bfr[GDB_BFR_MAX];
 static u32 cmd_len;
 
-static u32 sig = 0;
-static u32 send_signal = 0;
+// socket buffers: bytes received but not parsed yet, and acks and
+// replies not sent yet
+static u8 rx_bfr[GDB_RX_MAX];
+static u32 rx_pos, rx_len;
+static u8 tx_bfr[GDB_BFR_MAX + 8];
+static u32 tx_len;
+
+// QStartNoAckMode: no more + and - after packets
+static int no_ack;
+
+// stop reason of a watchpoint hit while going forward again, which
+// doesn't stop
+static char replay_reason[32];
+
+enum {
+	GDB_RUNNING,
+	GDB_STOPPED,
+	GDB_EXITED
+};
+
+// every context is a thread to gdb, ids start at 1. a thread's context
+// only runs while it is GDB_RUNNING, the server thread uses it otherwise.
+struct gdb_thread {
+	u32 id;
+	struct ctx_t *ctx;
+	int state;
+	pthread_cond_t resume;
+	// the last stop: signal and extra stop reply fields ("watch:addr;")
+	u32 sig;
+	char stop_reason[32];
+	// non-stop: stopped, but gdb wasn't told yet
+	int unreported;
+	// a break, all-stop or vCont;t asks it to stop with stop_sig
+	int stop_req;
+	u32 stop_sig;
+	// s and vCont;s/r: run one instruction, then stop before the first
+	// one outside [step_start, step_end)
+	int stepping;
+	int step_first;
+	u32 step_start, step_end;
+	// watchpoints stop before the access, so the first instruction after
+	// a resume makes it without checking them
+	int resumed;
+	int watch_skip;
+};
+
+static struct gdb_thread *threads[GDB_MAX_THREADS];
+static u32 n_threads;
+static __thread struct gdb_thread *self;
+// Hg: registers and memory, Hc: s and c (NULL for all)
+static struct gdb_thread *g_thread, *c_thread;
+
+// the server thread reads packets and handles them under gdb_lock. context
+// threads take it to stop, and wait on their resume condition while
+// stopped. stop requests for running threads show up in gdb_interrupt,
+// which the run loops check between blocks.
+volatile int gdb_interrupt;
+static pthread_t server;
+static int serving, server_quit;
+static pthread_mutex_t gdb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stopped = PTHREAD_COND_INITIALIZER;
+// QNonStop:1, stops are %Stop notifications and don't stop other threads
+static int non_stop;
+// all-stop: gdb waits for the stop reply to a resume
+static int waiting;
+// non-stop: a notification is out, gdb drains the rest with vStopped
+static int notifying;
+// the conditions of breakpoints are evaluated on the context threads
+// while gdb may change them in non-stop mode
+static pthread_rwlock_t bp_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 typedef struct {
 	u32 active;
 	u32 addr;
 	u32 len;
+	// agent expressions from Z packets, the breakpoint only triggers if
+	// one of them is true
+	u32 n_cond;
+	u8 *cond[GDB_MAX_COND];
+	u32 cond_len[GDB_MAX_COND];
 } gdb_bp_t;
 
 static gdb_bp_t bp_x[GDB_MAX_BP];
 static gdb_bp_t bp_r[GDB_MAX_BP];
 static gdb_bp_t bp_w[GDB_MAX_BP];
 static gdb_bp_t bp_a[GDB_MAX_BP];
+// active breakpoints of all types, the checks are free while it is 0
+static u32 bp_count;
 
 // private helpers
 static u8 hex2char(u8 hex)
@@ -104,13 +195,35 @@ static void hex2mem(u8 *dst, u8 *src, u32 len)
 static u8 gdb_read_byte(void)
 {
 	ssize_t res;
-	u8 c;
 
-	res = recv(sock, &c, 1, MSG_WAITALL);
-	if (res != 1)
-		fail("recv failed");
+	if (rx_pos == rx_len) {
+		do
+			res = recv(sock, (char *)rx_bfr, sizeof rx_bfr, 0);
+		while (res < 0 && errno == EINTR);
+		if (res <= 0 && server_quit)
+			pthread_exit(NULL);
+		if (res <= 0)
+			fail("recv failed");
+		rx_pos = 0;
+		rx_len = res;
+	}
 
-	return c;
+	return rx_bfr[rx_pos++];
+}
+
+static void gdb_flush(void)
+{
+	u8 *ptr;
+	int n;
+
+	ptr = tx_bfr;
+	while (tx_len > 0) {
+		n = send(sock, (char *)ptr, tx_len, 0);
+		if (n < 0)
+			fail("gdb: send failed");
+		tx_len -= n;
+		ptr += n;
+	}
 }
 
 static u8 gdb_calc_chksum(void)
@@ -131,11 +244,11 @@ static gdb_bp_t *gdb_bp_ptr(u32 type)
 		case GDB_BP_TYPE_X:
 			return bp_x;
 		case GDB_BP_TYPE_R:
-			return bp_x;
+			return bp_r;
 		case GDB_BP_TYPE_W:
-			return bp_x;
+			return bp_w;
 		case GDB_BP_TYPE_A:
-			return bp_x;
+			return bp_a;
 		default:
 			return NULL;
 	}
@@ -177,6 +290,31 @@ static gdb_bp_t *gdb_bp_find(u32 type, u32 addr, u32 len)
 	return NULL;
 }
 
+static void gdb_bp_free_cond(gdb_bp_t *bp)
+{
+	u32 i;
+
+	for (i = 0; i < bp->n_cond; i++)
+		free(bp->cond[i]);
+	bp->n_cond = 0;
+}
+
+// no condition, a true one or one we can't evaluate
+static int gdb_bp_cond(const gdb_bp_t *bp)
+{
+	u64 v;
+	u32 i;
+
+	if (bp->n_cond == 0)
+		return 1;
+
+	for (i = 0; i < bp->n_cond; i++)
+		if (agent_eval(bp->cond[i], bp->cond_len[i], &v) < 0 || v != 0)
+			return 1;
+
+	return 0;
+}
+
 static void gdb_bp_remove(u32 type, u32 addr, u32 len)
 {
 	gdb_bp_t *p;
@@ -185,8 +323,9 @@ static void gdb_bp_remove(u32 type, u32 addr, u32 len)
 		p = gdb_bp_find(type, addr, len);
 		if (p != NULL) {
 			dbgprintf("gdb: remvoed a breakpoint: %08x bytes at %08x\n", len, addr);
-			p->active = 0;
-			memset(p, 0, sizeof p);
+			gdb_bp_free_cond(p);
+			memset(p, 0, sizeof *p);
+			bp_count--;
 		}
 	} while (p != NULL);
 }
@@ -195,38 +334,42 @@ static int gdb_bp_check(u32 addr, u32 type)
 {
 	gdb_bp_t *p;
 	u32 i;
+	int hit;
+
+	if (bp_count == 0)
+		return 0;
 
 	p = gdb_bp_ptr(type);
 	if (p == NULL)
 		return 0;
 
-	for (i = 0; i < GDB_MAX_BP; i++) {
+	hit = 0;
+	pthread_rwlock_rdlock(&bp_lock);
+	for (i = 0; i < GDB_MAX_BP && !hit; i++) {
 		if (p[i].active == 1 &&
-		    (addr >= p[i].addr && addr < p[i].addr + p[i].len))
-			return 1;
+		    (addr >= p[i].addr && addr < p[i].addr + p[i].len) &&
+		    gdb_bp_cond(&p[i]))
+			hit = 1;
 	}
+	pthread_rwlock_unlock(&bp_lock);
 
-	return 0;
+	return hit;
 }
 
 static void gdb_nak(void)
 {
-	const char nak = GDB_STUB_NAK;
-	ssize_t res;
-
-	res = send(sock, &nak, 1, 0);
-	if (res != 1)
-		fail("send failed");
+	if (no_ack)
+		return;
+	tx_bfr[tx_len++] = GDB_STUB_NAK;
+	gdb_flush();
 }
 
+// queued, it goes out with the reply
 static void gdb_ack(void)
 {
-	const char ack = GDB_STUB_ACK;
-	ssize_t res;
-
-	res = send(sock, &ack, 1, 0);
-	if (res != 1)
-		fail("send failed");
+	if (no_ack)
+		return;
+	tx_bfr[tx_len++] = GDB_STUB_ACK;
 }
 
 static void gdb_read_command(void)
@@ -235,9 +378,13 @@ static void gdb_read_command(void)
 	u8 chk_read, chk_calc;
 
 	cmd_len = 0;
-	memset(cmd_bfr, 0, sizeof cmd_bfr);
 
 	c = gdb_read_byte();
+	if (c == GDB_STUB_BREAK) {
+		cmd_bfr[0] = c;
+		cmd_len = 1;
+		return;
+	}
 	if (c != GDB_STUB_START) {
 		dbgprintf("gdb: read invalid byte %02x\n", c);
 		return;
@@ -245,9 +392,10 @@ static void gdb_read_command(void)
 
 	while ((c = gdb_read_byte()) != GDB_STUB_END) {
 		cmd_bfr[cmd_len++] = c;
-		if (cmd_len == sizeof cmd_bfr)
+		if (cmd_len == sizeof cmd_bfr - 1)
 			fail("gdb: cmd_bfr overflow\n");
 	}
+	cmd_bfr[cmd_len] = 0;
 
 	chk_read = hex2char(gdb_read_byte()) << 4;
 	chk_read |= hex2char(gdb_read_byte());
@@ -257,91 +405,414 @@ static void gdb_read_command(void)
 	if (chk_calc != chk_read) {
 		printf("gdb: invalid checksum: calculated %02x and read %02x for $%s# (length: %d)\n", chk_calc, chk_read, cmd_bfr, cmd_len);
 		cmd_len = 0;
-	
+
+		pthread_mutex_lock(&gdb_lock);
 		gdb_nak();
+		pthread_mutex_unlock(&gdb_lock);
 	}
 
 	dbgprintf("gdb: read command %c with a length of %d: %s\n", cmd_bfr[0], cmd_len, cmd_bfr);
 }
 
-static int gdb_data_available(void) {
-	struct timeval t;
-	fd_set _fds, *fds = &_fds;
-	
-	FD_ZERO(fds);
-	FD_SET(sock, fds);
+// sends a packet, or a notification for start '%', after the queued ack
+static void gdb_packet(u8 start, const u8 *reply, u32 len)
+{
+	u8 chk;
+	u32 i;
 
-	t.tv_sec = 0;
-	t.tv_usec = 20;
+	if (tx_len + len + 4 > sizeof tx_bfr)
+		fail("tx_bfr overflow in gdb_reply");
 
-	if (select(sock + 1, fds, NULL, NULL, &t) < 0)
-		fail("select failed");
+	chk = 0;
+	for (i = 0; i < len; i++)
+		chk += reply[i];
 
-	if (FD_ISSET(sock, fds))
-		return 1;
-	return 0;
+	tx_bfr[tx_len++] = start;
+	memcpy(tx_bfr + tx_len, reply, len);
+	tx_len += len;
+	tx_bfr[tx_len++] = GDB_STUB_END;
+	tx_bfr[tx_len++] = nibble2hex(chk >> 4);
+	tx_bfr[tx_len++] = nibble2hex(chk);
+
+	dbgprintf("gdb: reply (len: %d): %c%.*s\n", len, start, len, reply);
+	gdb_flush();
+}
+
+// len bytes of packet data, already escaped if binary
+static void gdb_reply_bin(const u8 *reply, u32 len)
+{
+	gdb_packet(GDB_STUB_START, reply, len);
 }
 
 static void gdb_reply(const char *reply)
 {
-	u8 chk;
-	u32 left;
-	u8 *ptr;
-	int n;
+	gdb_reply_bin((const u8 *)reply, strlen(reply));
+}
 
-	memset(cmd_bfr, 0, sizeof cmd_bfr);
+// escapes len bytes of binary data for a packet, returns the bytes written
+static u32 gdb_escape(u8 *dst, const u8 *src, u32 len)
+{
+	u32 n;
+
+	for (n = 0; len-- > 0; src++) {
+		if (*src == GDB_STUB_START || *src == GDB_STUB_END ||
+		    *src == GDB_STUB_ESC || *src == '*') {
+			dst[n++] = GDB_STUB_ESC;
+			dst[n++] = *src ^ 0x20;
+		} else {
+			dst[n++] = *src;
+		}
+	}
+	return n;
+}
 
-	cmd_len = strlen(reply);
-	if (cmd_len + 4 > sizeof cmd_bfr)
-		fail("cmd_bfr overflow in gdb_reply");
+// parses a hex number at cmd_bfr[*i] up to stop or the end of the packet
+static u32 gdb_hex_field(u32 *i, u8 stop)
+{
+	u32 v = 0;
 
-	memcpy(cmd_bfr + 1, reply, cmd_len);
+	while (*i < cmd_len && cmd_bfr[*i] != stop)
+		v = (v << 4) | hex2char(cmd_bfr[(*i)++]);
+	(*i)++;
+	return v;
+}
 
-	cmd_len++;
-	chk = gdb_calc_chksum();
-	cmd_len--;
-	cmd_bfr[0] = GDB_STUB_START;
-	cmd_bfr[cmd_len + 1] = GDB_STUB_END;
-	cmd_bfr[cmd_len + 2] = nibble2hex(chk >> 4);
-	cmd_bfr[cmd_len + 3] = nibble2hex(chk);
+// monitor commands: "snapshot [file]"
+static void gdb_handle_rcmd(void)
+{
+	static char cmd[GDB_BFR_MAX / 2];
+	const char *arg;
+	u32 i, len;
+
+	len = (cmd_len - 6) / 2;
+	hex2mem((u8 *)cmd, cmd_bfr + 6, len);
+	cmd[len] = 0;
+	dbgprintf("gdb: monitor '%s'\n", cmd);
+
+	if (strncmp(cmd, "snapshot", 8) == 0 && (cmd[8] == 0 || cmd[8] == ' ')) {
+		for (i = 8; cmd[i] == ' '; i++)
+			;
+		arg = cmd[i] ? cmd + i : SNAPSHOT_NAME;
+		snapshot_save(arg, ctx->pc);
+		return gdb_reply("OK");
+	}
 
-	dbgprintf("gdb: reply (len: %d): %s\n", cmd_len, cmd_bfr);
+	gdb_reply("E01");
+}
 
-	ptr = cmd_bfr;
-	left = cmd_len + 4;
-	while (left > 0) {
-		n = send(sock, ptr, left, 0);
-		if (n < 0)
-			fail("gdb: send failed");
-		left -= n;
-		ptr += n;
+// qXfer:spu:read:annex:offset,length, annex is [id/]mem or [id/]regs
+static void gdb_handle_xfer(void)
+{
+	static u8 reply[GDB_BFR_MAX];
+	u8 regs[128 * 16];
+	const u8 *obj;
+	const char *annex, *end;
+	u32 i, j, offset, len, size;
+
+	annex = (const char *)cmd_bfr + 15;
+	end = memchr(annex, ':', cmd_len - 15);
+	if (end == NULL)
+		return gdb_reply("E01");
+
+	if (end - annex >= 3 && memcmp(end - 3, "mem", 3) == 0) {
+		obj = ctx->ls;
+		size = LS_SIZE;
+	} else if (end - annex >= 4 && memcmp(end - 4, "regs", 4) == 0) {
+		for (i = 0; i < 128; i++)
+			for (j = 0; j < 4; j++)
+				wbe32(regs + i * 16 + j * 4, ctx->reg[i][j]);
+		obj = regs;
+		size = sizeof regs;
+	} else {
+		return gdb_reply("E00");
 	}
+
+	i = end + 1 - (const char *)cmd_bfr;
+	offset = gdb_hex_field(&i, ',');
+	len = gdb_hex_field(&i, 0);
+	dbgprintf("gdb: xfer %.*s: %08x bytes at %08x\n", (int)(end - annex), annex, len, offset);
+
+	if (offset >= size)
+		return gdb_reply("l");
+
+	// every byte may need escaping
+	if (len > (GDB_PACKET_SIZE - 1) / 2)
+		len = (GDB_PACKET_SIZE - 1) / 2;
+	if (len > size - offset)
+		len = size - offset;
+
+	reply[0] = offset + len == size ? 'l' : 'm';
+	gdb_reply_bin(reply, 1 + gdb_escape(reply + 1, obj + offset, len));
+}
+
+// gdb's crc32: polynomial 0x04c11db7, msb first, starts at ~0, not
+// inverted at the end
+static u32 gdb_crc32(const u8 *p, u32 len)
+{
+	static u32 table[256];
+	u32 crc, c;
+	u32 i, j;
+
+	if (table[1] == 0) {
+		for (i = 0; i < 256; i++) {
+			c = i << 24;
+			for (j = 0; j < 8; j++)
+				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : c << 1;
+			table[i] = c;
+		}
+	}
+
+	crc = ~0;
+	while (len--)
+		crc = (crc << 8) ^ table[((crc >> 24) ^ *p++) & 0xff];
+	return crc;
+}
+
+// qCRC:addr,length, for compare-sections
+static void gdb_handle_crc(void)
+{
+	char bfr[16];
+	u32 addr, len;
+	u32 i;
+
+	i = 5;
+	addr = gdb_hex_field(&i, ',') & LSLR;
+	len = gdb_hex_field(&i, 0);
+	if (len > LS_SIZE - addr)
+		return gdb_reply("E01");
+
+	sprintf(bfr, "C%08x", gdb_crc32(ctx->ls + addr, len));
+	gdb_reply(bfr);
+}
+
+// qSearch:memory:addr;length;pattern, for find. the pattern is binary.
+// memchr() finds the candidates for its first byte.
+static void gdb_handle_search(void)
+{
+	static u8 pattern[GDB_BFR_MAX];
+	const u8 *p, *end;
+	char bfr[16];
+	u32 addr, len, n;
+	u32 i;
+
+	i = 15;
+	addr = gdb_hex_field(&i, ';') & LSLR;
+	len = gdb_hex_field(&i, ';');
+	if (len > LS_SIZE - addr)
+		len = LS_SIZE - addr;
+
+	for (n = 0; i < cmd_len; n++) {
+		if (cmd_bfr[i] == GDB_STUB_ESC && i + 1 < cmd_len) {
+			pattern[n] = cmd_bfr[i + 1] ^ 0x20;
+			i += 2;
+		} else {
+			pattern[n] = cmd_bfr[i++];
+		}
+	}
+	if (n == 0 || n > len)
+		return gdb_reply("0");
+
+	p = ctx->ls + addr;
+	end = ctx->ls + addr + len - n + 1;
+	while ((p = memchr(p, pattern[0], end - p)) != NULL) {
+		if (memcmp(p, pattern, n) == 0) {
+			sprintf(bfr, "1,%x", (u32)(p - ctx->ls));
+			return gdb_reply(bfr);
+		}
+		p++;
+	}
+	gdb_reply("0");
+}
+
+// a live thread by id, 0 is any of them
+static struct gdb_thread *gdb_thread_find(u32 id)
+{
+	u32 i;
+
+	for (i = 0; i < n_threads; i++)
+		if (threads[i]->state != GDB_EXITED && (id == 0 || threads[i]->id == id))
+			return threads[i];
+	return NULL;
+}
+
+// thread id at cmd_bfr[*i] up to stop, -1 (all threads) gives NULL.
+// returns -1 for threads that don't exist.
+static int gdb_thread_field(u32 *i, u8 stop, struct gdb_thread **t)
+{
+	u32 id;
+
+	if (*i < cmd_len && cmd_bfr[*i] == '-') {
+		while (*i < cmd_len && cmd_bfr[*i] != stop)
+			(*i)++;
+		(*i)++;
+		*t = NULL;
+		return 0;
+	}
+
+	id = gdb_hex_field(i, stop);
+	*t = gdb_thread_find(id);
+	return *t == NULL ? -1 : 0;
+}
+
+static void gdb_stop_reply(const struct gdb_thread *t, char *bfr)
+{
+	sprintf(bfr, "T%02x%sthread:%x;81:%08x;", t->sig, t->stop_reason, t->id, t->ctx->pc);
+}
+
+static void gdb_reply_stop(const struct gdb_thread *t)
+{
+	char bfr[128];
+
+	gdb_stop_reply(t, bfr);
+	gdb_reply(bfr);
+}
+
+// non-stop: tells gdb about the next stop it doesn't know of yet, or that
+// there are no more
+static void gdb_reply_stopped(void)
+{
+	u32 i;
+
+	for (i = 0; i < n_threads; i++) {
+		if (threads[i]->state == GDB_STOPPED && threads[i]->unreported) {
+			threads[i]->unreported = 0;
+			notifying = 1;
+			return gdb_reply_stop(threads[i]);
+		}
+	}
+	notifying = 0;
+	gdb_reply("OK");
+}
+
+static void gdb_handle_signal(void)
+{
+	struct gdb_thread *t;
+	u32 i;
+
+	gdb_ack();
+	if (non_stop) {
+		for (i = 0; i < n_threads; i++)
+			threads[i]->unreported = threads[i]->state == GDB_STOPPED;
+		return gdb_reply_stopped();
+	}
+
+	t = g_thread != NULL && g_thread->state == GDB_STOPPED ? g_thread : NULL;
+	for (i = 0; t == NULL && i < n_threads; i++)
+		if (threads[i]->state == GDB_STOPPED)
+			t = threads[i];
+	if (t == NULL)
+		return gdb_reply("W00");
+	gdb_reply_stop(t);
+}
+
+static void gdb_handle_thread_info(void)
+{
+	static char bfr[GDB_MAX_THREADS * 4 + 2];
+	u32 i, n;
+
+	n = 0;
+	bfr[n++] = 'm';
+	for (i = 0; i < n_threads; i++)
+		if (threads[i]->state != GDB_EXITED)
+			n += sprintf(bfr + n, "%s%x", n > 1 ? "," : "", threads[i]->id);
+	gdb_reply(n > 1 ? bfr : "l");
+}
+
+// qThreadExtraInfo,id
+static void gdb_handle_extra_info(void)
+{
+	struct gdb_thread *t;
+	char info[64];
+	u8 bfr[128];
+	u32 i;
+
+	i = 17;
+	if (gdb_thread_field(&i, 0, &t) < 0 || t == NULL)
+		return gdb_reply("E01");
+	snprintf(info, sizeof info, "SPU %08x, %s", SPU_ID + t->id - 1,
+		t->state == GDB_STOPPED ? "stopped" : "running");
+	mem2hex(bfr, (u8 *)info, strlen(info));
+	gdb_reply_bin(bfr, 2 * strlen(info));
 }
 
 static void gdb_handle_query(void)
 {
+	char bfr[192];
+
 	dbgprintf("gdb: query '%s'\n", cmd_bfr+1);
 	gdb_ack();
+	if (memcmp(cmd_bfr, "qRcmd,", 6) == 0)
+		return gdb_handle_rcmd();
+	if (memcmp(cmd_bfr, "qSupported", 10) == 0) {
+		sprintf(bfr, "PacketSize=%x;QStartNoAckMode+;qXfer:spu:read+;ConditionalBreakpoints+;QNonStop+%s",
+			GDB_PACKET_SIZE, reverse_enabled ? ";ReverseStep+;ReverseContinue+" : "");
+		return gdb_reply(bfr);
+	}
+	if (cmd_len > 15 && memcmp(cmd_bfr, "qXfer:spu:read:", 15) == 0)
+		return gdb_handle_xfer();
+	if (cmd_len > 5 && memcmp(cmd_bfr, "qCRC:", 5) == 0)
+		return gdb_handle_crc();
+	if (cmd_len > 15 && memcmp(cmd_bfr, "qSearch:memory:", 15) == 0)
+		return gdb_handle_search();
+	if (strcmp((char *)cmd_bfr, "qfThreadInfo") == 0)
+		return gdb_handle_thread_info();
+	if (strcmp((char *)cmd_bfr, "qsThreadInfo") == 0)
+		return gdb_reply("l");
+	if (strcmp((char *)cmd_bfr, "qC") == 0) {
+		sprintf(bfr, "QC%x", g_thread != NULL ? g_thread->id : 0);
+		return gdb_reply(bfr);
+	}
+	if (memcmp(cmd_bfr, "qThreadExtraInfo,", 17) == 0)
+		return gdb_handle_extra_info();
 	gdb_reply("");
 }
 
-static void gdb_handle_set_thread(void)
+static void gdb_handle_set(void)
 {
 	gdb_ack();
-	if (memcmp(cmd_bfr, "Hg0", 3) == 0 ||
-	    memcmp(cmd_bfr, "Hc-1", 4) == 0)
+	if (cmd_len == 15 && memcmp(cmd_bfr, "QStartNoAckMode", 15) == 0) {
+		gdb_reply("OK");
+		no_ack = 1;
+		return;
+	}
+	if (cmd_len == 10 && memcmp(cmd_bfr, "QNonStop:", 9) == 0) {
+		non_stop = cmd_bfr[9] == '1';
+		notifying = 0;
 		return gdb_reply("OK");
-	gdb_reply("E01");
+	}
+	gdb_reply("");
 }
 
-static void gdb_handle_signal(void)
+// Hg thread: registers and memory, Hc thread: s and c. -1 is all threads
+// for Hc, 0 is any.
+static void gdb_handle_set_thread(void)
 {
-	char bfr[128];
+	struct gdb_thread *t;
+	u32 i;
 
 	gdb_ack();
-	memset(bfr, 0, sizeof bfr);
-	sprintf(bfr, "T%02x81:%08x;", sig, ctx->pc);
-	gdb_reply(bfr);
+	i = 2;
+	if ((cmd_bfr[1] != 'g' && cmd_bfr[1] != 'c') || gdb_thread_field(&i, 0, &t) < 0)
+		return gdb_reply("E01");
+
+	if (cmd_bfr[1] == 'c')
+		c_thread = t;
+	else if (t != NULL)
+		g_thread = t;
+	gdb_reply("OK");
+}
+
+// T thread: is it alive
+static void gdb_handle_thread_alive(void)
+{
+	struct gdb_thread *t;
+	u32 i;
+
+	gdb_ack();
+	i = 1;
+	if (gdb_thread_field(&i, 0, &t) < 0 || t == NULL)
+		return gdb_reply("E01");
+	gdb_reply("OK");
 }
 
 static void wbe32hex(u8 *p, u32 v)
@@ -354,7 +825,7 @@ static void wbe32hex(u8 *p, u32 v)
 
 static void gdb_read_registers(void)
 {
-	static u8 bfr[GDB_BFR_MAX - 4];
+	static u8 bfr[128 * 32 + 1];
 	u32 i;
 
 	gdb_ack();
@@ -394,6 +865,7 @@ static void gdb_write_registers(void)
 		ctx->reg[i][3] = re32hex(cmd_bfr + i*32 + 24);
 	}
 
+	reverse_clear();
 	gdb_reply("OK");
 }
 
@@ -416,7 +888,7 @@ static void gdb_read_register(void)
 			break;
 		case 128:
 			// SPU ID
-			wbe32hex(reply, SPU_ID);
+			wbe32hex(reply, SPU_ID + g_thread->id - 1);
 			break;
 		case 129:
 			// PC
@@ -444,6 +916,7 @@ static void gdb_write_register(void)
 		while (i < cmd_len)
 			ctx->pc = (ctx->pc << 4) | hex2char(cmd_bfr[i++]);
 		ctx->pc -= 4;
+		reverse_clear();
 		gdb_reply("OK");
 		return;
 	}
@@ -456,12 +929,13 @@ static void gdb_write_register(void)
 	ctx->reg[id][1] = re32hex(cmd_bfr + 4 +  8);
 	ctx->reg[id][2] = re32hex(cmd_bfr + 4 + 16);
 	ctx->reg[id][3] = re32hex(cmd_bfr + 4 + 24);
+	reverse_clear();
 	gdb_reply("OK");
 }
 
 static void gdb_read_mem(void)
 {
-	static u8 reply[GDB_BFR_MAX - 4];
+	static u8 reply[GDB_BFR_MAX];
 	u32 addr, len;
 	u32 i;
 
@@ -480,11 +954,14 @@ static void gdb_read_mem(void)
 		len = (len << 4) | hex2char(cmd_bfr[i++]);
 	dbgprintf("gdb: read memory: %08x bytes from %08x\n", len, addr);
 
-	if (len*2 > sizeof reply)
-		gdb_reply("E01");
+	// short reads are fine, gdb asks for the rest
+	if (len > GDB_PACKET_SIZE / 2)
+		len = GDB_PACKET_SIZE / 2;
+	if (len > LS_SIZE - addr)
+		len = LS_SIZE - addr;
 
 	mem2hex(reply, ctx->ls + addr, len);
-	gdb_reply((char *)reply);	
+	gdb_reply_bin(reply, 2 * len);
 }
 
 static void gdb_write_mem(void)
@@ -495,33 +972,326 @@ static void gdb_write_mem(void)
 	gdb_ack();
 
 	i = 1;
-	addr = 0;
-	while (cmd_bfr[i] != ',')
-		addr = (addr << 4) | hex2char(cmd_bfr[i++]);
-
-	addr &= LSLR;
-	i++;
-
-	len = 0;
-	while (cmd_bfr[i] != ':')
-		len = (len << 4) | hex2char(cmd_bfr[i++]);
+	addr = gdb_hex_field(&i, ',') & LSLR;
+	len = gdb_hex_field(&i, ':');
 	dbgprintf("gdb: write memory: %08x bytes to %08x\n", len, addr);
 
+	if (len > LS_SIZE - addr)
+		return gdb_reply("E01");
+	// the rest of the buffer is left over from earlier packets
+	if (i > cmd_len || cmd_len - i < 2 * len)
+		return gdb_reply("E02");
+
+	dirty_mark(addr, len);
 	hex2mem(ctx->ls + addr, cmd_bfr + i, len);
+	reverse_clear();
 	gdb_reply("OK");
 }
 
+// X addr,len:binary data
+static void gdb_write_mem_bin(void)
+{
+	u32 addr, len;
+	u32 i, n;
+	u8 *data;
+
+	gdb_ack();
+
+	i = 1;
+	addr = gdb_hex_field(&i, ',') & LSLR;
+	len = gdb_hex_field(&i, ':');
+	dbgprintf("gdb: write memory: %08x bytes to %08x (binary)\n", len, addr);
+
+	if (len > LS_SIZE - addr)
+		return gdb_reply("E01");
+
+	// unescaped in place, it never gets longer. a short packet leaves
+	// the local store alone.
+	data = cmd_bfr + i;
+	for (n = 0; n < len && i < cmd_len; n++) {
+		if (cmd_bfr[i] == GDB_STUB_ESC && i + 1 < cmd_len) {
+			data[n] = cmd_bfr[i + 1] ^ 0x20;
+			i += 2;
+		} else {
+			data[n] = cmd_bfr[i++];
+		}
+	}
+	if (n != len)
+		return gdb_reply("E02");
+
+	dirty_mark(addr, len);
+	memcpy(ctx->ls + addr, data, len);
+	reverse_clear();
+	gdb_reply("OK");
+}
+
+// a stopped thread tells gdb about it: all-stop stops the others and
+// answers the resume gdb waits on, non-stop sends a notification. called
+// with gdb_lock held.
+static void gdb_stopped(struct gdb_thread *t, u32 s)
+{
+	char bfr[128];
+	u32 i;
+
+	t->sig = s;
+	t->state = GDB_STOPPED;
+	t->stepping = 0;
+	if (t->stop_req) {
+		t->stop_req = 0;
+		gdb_interrupt--;
+	}
+	pthread_cond_broadcast(&stopped);
+
+	if (non_stop) {
+		t->unreported = 1;
+		if (notifying)
+			return;
+		t->unreported = 0;
+		notifying = 1;
+		strcpy(bfr, "Stop:");
+		gdb_stop_reply(t, bfr + 5);
+		gdb_packet('%', (u8 *)bfr, strlen(bfr));
+		return;
+	}
+
+	if (!waiting)
+		return;
+	waiting = 0;
+	for (i = 0; i < n_threads; i++) {
+		if (threads[i]->state == GDB_RUNNING && !threads[i]->stop_req) {
+			threads[i]->stop_req = 1;
+			threads[i]->stop_sig = 0;
+			gdb_interrupt++;
+		}
+	}
+	for (;;) {
+		for (i = 0; i < n_threads && threads[i]->state != GDB_RUNNING; i++)
+			;
+		if (i == n_threads)
+			break;
+		pthread_cond_wait(&stopped, &gdb_lock);
+	}
+
+	g_thread = t;
+	gdb_reply_stop(t);
+}
+
+static void gdb_resume(struct gdb_thread *t, int step, u32 start, u32 end)
+{
+	if (t->state != GDB_STOPPED)
+		return;
+
+	t->stepping = step;
+	t->step_first = 1;
+	t->step_start = start;
+	t->step_end = end;
+	t->stop_reason[0] = 0;
+	t->resumed = 1;
+	t->unreported = 0;
+	t->state = GDB_RUNNING;
+	t->ctx->paused = 0;
+	pthread_cond_signal(&t->resume);
+}
+
+// all-stop gdb waits for a stop reply after a resume. with every thread
+// gone or none resumed it has to get one right away.
+static void gdb_resumed(void)
+{
+	u32 i;
+
+	if (non_stop)
+		return gdb_reply("OK");
+
+	for (i = 0; i < n_threads && threads[i]->state != GDB_RUNNING; i++)
+		;
+	if (i < n_threads) {
+		waiting = 1;
+		gdb_flush();
+		return;
+	}
+
+	if (g_thread == NULL || g_thread->state != GDB_STOPPED)
+		g_thread = gdb_thread_find(0);
+	if (g_thread == NULL)
+		return gdb_reply("W00");
+	g_thread->sig = 0;
+	gdb_reply_stop(g_thread);
+}
+
 static void gdb_continue(void)
 {
+	u32 i;
+
+	gdb_ack();
+	for (i = 0; i < n_threads; i++)
+		gdb_resume(threads[i], 0, 0, 0);
+	gdb_resumed();
+}
+
+// s [addr]: steps the Hc thread, the others continue
+static void gdb_step(void)
+{
+	struct gdb_thread *t;
+	u32 i;
+
 	gdb_ack();
-	ctx->paused = 0;
-	send_signal = 1;
+	t = c_thread != NULL ? c_thread : g_thread;
+	if (t == NULL || t->state != GDB_STOPPED)
+		return gdb_reply("E01");
+	if (cmd_len > 1) {
+		i = 1;
+		t->ctx->pc = gdb_hex_field(&i, 0) & LSLR & ~3;
+		reverse_clear();
+	}
+	gdb_resume(t, 1, 0, 0);
+	for (i = 0; i < n_threads; i++)
+		gdb_resume(threads[i], 0, 0, 0);
+	gdb_resumed();
 }
 
+// vCont;action[:thread][;action[:thread]...], each thread does the first
+// action that names it or no thread at all
+static void gdb_handle_vcont(void)
+{
+	struct gdb_thread *t;
+	u8 done[GDB_MAX_THREADS];
+	u32 i, n, start, end;
+	u8 action;
+
+	if (cmd_len == 6 && cmd_bfr[5] == '?')
+		return gdb_reply("vCont;c;C;s;S;r;t");
+	if (cmd_len < 7 || cmd_bfr[5] != ';')
+		return gdb_reply("E01");
+
+	memset(done, 0, sizeof done);
+	i = 5;
+	while (i < cmd_len && cmd_bfr[i] == ';') {
+		action = cmd_bfr[++i];
+		start = end = 0;
+		if (action == 'C' || action == 'S') {
+			i += 3;		// the signal, there is nothing to deliver it to
+		} else if (action == 'r') {
+			i++;
+			start = gdb_hex_field(&i, ',') & LSLR;
+			while (i < cmd_len && cmd_bfr[i] != ':' && cmd_bfr[i] != ';')
+				end = (end << 4) | hex2char(cmd_bfr[i++]);
+		} else if (action == 'c' || action == 's' || action == 't') {
+			i++;
+		} else {
+			return gdb_reply("E01");
+		}
+
+		t = NULL;
+		if (i < cmd_len && cmd_bfr[i] == ':') {
+			i++;
+			if (gdb_thread_field(&i, ';', &t) < 0)
+				return gdb_reply("E01");
+			i--;
+		}
+
+		for (n = 0; n < n_threads; n++) {
+			if ((t != NULL && t != threads[n]) || done[n])
+				continue;
+			done[n] = 1;
+			if (action == 't') {
+				if (threads[n]->state == GDB_RUNNING && !threads[n]->stop_req) {
+					threads[n]->stop_req = 1;
+					threads[n]->stop_sig = 0;
+					gdb_interrupt++;
+				}
+				continue;
+			}
+			gdb_resume(threads[n], action != 'c' && action != 'C', start, end);
+		}
+	}
+	gdb_resumed();
+}
+
+static void gdb_handle_v(void)
+{
+	gdb_ack();
+	if (cmd_len >= 5 && memcmp(cmd_bfr, "vCont", 5) == 0)
+		return gdb_handle_vcont();
+	if (strcmp((char *)cmd_bfr, "vStopped") == 0)
+		return gdb_reply_stopped();
+	gdb_reply("");
+}
+
+// bs: back to before the last step
+static void gdb_reverse_step(void)
+{
+	if (reverse_count == reverse_begin())
+		strcpy(g_thread->stop_reason, "replaylog:begin;");
+	else
+		reverse_goto(reverse_count - 1);
+	gdb_reply_stop(g_thread);
+}
+
+// bc: runs the checkpoint intervals before the current step forward again,
+// newest first, and goes back to the last breakpoint or watchpoint hit in
+// the newest one that has any. a watchpoint stops before the access, like
+// going forward.
+static void gdb_reverse_continue(void)
+{
+	char reason[sizeof replay_reason];
+	u64 start, end, step, hit;
+
+	end = reverse_count;
+	while (end > reverse_begin()) {
+		start = reverse_prev(end);
+		reverse_goto(start);
+
+		hit = ~0ULL;
+		reverse_replaying = 1;
+		while (reverse_count < end) {
+			step = reverse_count;
+			replay_reason[0] = 0;
+			if (gdb_bp_check(ctx->pc, GDB_BP_TYPE_X)) {
+				hit = step;
+				reason[0] = 0;
+			}
+			emulate();
+			if (replay_reason[0] != 0) {
+				hit = step;
+				strcpy(reason, replay_reason);
+			}
+		}
+		reverse_replaying = 0;
+
+		if (hit != ~0ULL) {
+			reverse_goto(hit);
+			strcpy(g_thread->stop_reason, reason);
+			return gdb_reply_stop(g_thread);
+		}
+		end = start;
+	}
+
+	reverse_goto(reverse_begin());
+	strcpy(g_thread->stop_reason, "replaylog:begin;");
+	gdb_reply_stop(g_thread);
+}
+
+static void gdb_handle_reverse(void)
+{
+	gdb_ack();
+	if (!reverse_enabled || cmd_len != 2)
+		return gdb_reply("");
+
+	g_thread->stepping = 0;
+	g_thread->sig = SIGTRAP;
+	g_thread->stop_reason[0] = 0;
+	if (cmd_bfr[1] == 's')
+		return gdb_reverse_step();
+	if (cmd_bfr[1] == 'c')
+		return gdb_reverse_continue();
+	gdb_reply("");
+}
+
+// Z type,addr,kind[;X len,expr]...
 static void gdb_add_bp(void)
 {
-	gdb_bp_t *bp;
-	u32 type;
+	gdb_bp_t *bp, conds;
+	u32 type, addr, len, n;
 	u32 i;
 
 	gdb_ack();
@@ -545,24 +1315,53 @@ static void gdb_add_bp(void)
 			return gdb_reply("E01");
 	}
 
-	bp = gdb_bp_empty_slot(type);
-	if (bp == NULL)
-		return gdb_reply("E02");
-
-	bp->active = 1;
-	bp->addr = 0;
-	bp->len = 0;
-
 	i = 3;
-	while (cmd_bfr[i] != ',')
-		bp->addr = (bp->addr << 4) | hex2char(cmd_bfr[i++]);
-	i++;
+	addr = gdb_hex_field(&i, ',');
+	len = 0;
+	while (i < cmd_len && cmd_bfr[i] != ';')
+		len = (len << 4) | hex2char(cmd_bfr[i++]);
 
-	while (i < cmd_len)
-		bp->len = (bp->len << 4) | hex2char(cmd_bfr[i++]);
+	// all conditions first, a failed insert leaves no trace
+	memset(&conds, 0, sizeof conds);
+	while (i + 1 < cmd_len && cmd_bfr[i] == ';' && cmd_bfr[i + 1] == 'X') {
+		i += 2;
+		n = gdb_hex_field(&i, ',');
+		if (conds.n_cond == GDB_MAX_COND || i > cmd_len || n > (cmd_len - i) / 2)
+			goto bad;
+		conds.cond[conds.n_cond] = malloc(n ? n : 1);
+		if (conds.cond[conds.n_cond] == NULL)
+			goto bad;
+		hex2mem(conds.cond[conds.n_cond], cmd_bfr + i, n);
+		conds.cond_len[conds.n_cond++] = n;
+		i += 2 * n;
+	}
+
+	// gdb inserts a breakpoint again to change its conditions
+	bp = gdb_bp_find(type, addr, len);
+	if (bp == NULL) {
+		bp = gdb_bp_empty_slot(type);
+		if (bp == NULL) {
+			gdb_bp_free_cond(&conds);
+			return gdb_reply("E02");
+		}
+		bp->active = 1;
+		bp->addr = addr;
+		bp->len = len;
+		bp_count++;
+	}
+	gdb_bp_free_cond(bp);
+	memcpy(bp->cond, conds.cond, sizeof bp->cond);
+	memcpy(bp->cond_len, conds.cond_len, sizeof bp->cond_len);
+	bp->n_cond = conds.n_cond;
 
-	dbgprintf("gdb: added %d breakpoint: %08x bytes at %08x\n", type, bp->len, bp->addr);
+	dbgprintf("gdb: added %d breakpoint: %08x bytes at %08x, %u conditions\n",
+		type, bp->len, bp->addr, bp->n_cond);
 	gdb_reply("OK");
+	return;
+
+bad:
+	gdb_bp_free_cond(&conds);
+	gdb_reply("E03");
 }
 
 static void gdb_remove_bp(void)
@@ -605,11 +1404,26 @@ static void gdb_remove_bp(void)
 	gdb_reply("OK");
 }
 
+// registers, memory and going back need the Hg thread to be stopped
+static int gdb_needs_stop(u8 c)
+{
+	return strchr("gGpPmMXb", c) != NULL ||
+		(c == 'q' && memcmp(cmd_bfr, "qXfer:", 6) == 0) ||
+		(c == 'q' && memcmp(cmd_bfr, "qRcmd,", 6) == 0) ||
+		(c == 'q' && memcmp(cmd_bfr, "qCRC:", 5) == 0) ||
+		(c == 'q' && memcmp(cmd_bfr, "qSearch:", 8) == 0);
+}
+
 static void gdb_parse_command(void)
 {
 	if (cmd_len == 0)
 		return;
 
+	if (gdb_needs_stop(cmd_bfr[0]) && (g_thread == NULL || g_thread->state != GDB_STOPPED)) {
+		gdb_ack();
+		return gdb_reply("E01");
+	}
+
 	switch(cmd_bfr[0]) {
 		case 'q':
 			gdb_handle_query();
@@ -617,11 +1431,15 @@ static void gdb_parse_command(void)
 		case 'H':
 			gdb_handle_set_thread();
 			break;
+		case 'T':
+			gdb_handle_thread_alive();
+			break;
 		case '?':
 			gdb_handle_signal();
 			break;
 		case 'k':
 			gdb_ack();
+			gdb_flush();
 			fail("killed by gdb");
 			break;
 		case 'g':
@@ -642,14 +1460,33 @@ static void gdb_parse_command(void)
 		case 'M':
 			gdb_write_mem();
 			break;
+		case 'X':
+			gdb_write_mem_bin();
+			break;
+		case 'Q':
+			gdb_handle_set();
+			break;
 		case 'c':
 			gdb_continue();
 			break;
+		case 's':
+			gdb_step();
+			break;
+		case 'v':
+			gdb_handle_v();
+			break;
+		case 'b':
+			gdb_handle_reverse();
+			break;
 		case 'z':
+			pthread_rwlock_wrlock(&bp_lock);
 			gdb_remove_bp();
+			pthread_rwlock_unlock(&bp_lock);
 			break;
 		case 'Z':
+			pthread_rwlock_wrlock(&bp_lock);
 			gdb_add_bp();
+			pthread_rwlock_unlock(&bp_lock);
 			break;
 		default:
 			gdb_ack();
@@ -662,6 +1499,51 @@ static void gdb_parse_command(void)
 	WSADATA InitData;
 #endif
 
+static struct gdb_thread *gdb_self(void)
+{
+	u32 i;
+
+	if (self == NULL)
+		for (i = 0; i < n_threads; i++)
+			if (threads[i]->ctx == ctx)
+				self = threads[i];
+	return self;
+}
+
+static void *gdb_server(void *arg)
+{
+	u32 i;
+#ifndef _WIN32
+	sigset_t all;
+
+	// signals are for the context threads
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+#endif
+	(void)arg;
+
+	for (;;) {
+		gdb_read_command();
+
+		pthread_mutex_lock(&gdb_lock);
+		if (g_thread != NULL)
+			ctx = g_thread->ctx;
+		if (cmd_len == 1 && cmd_bfr[0] == GDB_STUB_BREAK) {
+			for (i = 0; i < n_threads; i++) {
+				if (threads[i]->state == GDB_RUNNING && !threads[i]->stop_req) {
+					threads[i]->stop_req = 1;
+					threads[i]->stop_sig = SIGINT;
+					gdb_interrupt++;
+				}
+			}
+		} else {
+			gdb_parse_command();
+		}
+		pthread_mutex_unlock(&gdb_lock);
+	}
+	return NULL;
+}
+
 // exported functions
 
 void gdb_init(u32 port)
@@ -676,6 +1558,7 @@ void gdb_init(u32 port)
 	memset(bp_r, 0, sizeof bp_r);
 	memset(bp_w, 0, sizeof bp_w);
 	memset(bp_a, 0, sizeof bp_a);
+	bp_count = 0;
 
 	tmpsock = socket(AF_INET, SOCK_STREAM, 0);
 	if (tmpsock == -1)
@@ -697,6 +1580,7 @@ void gdb_init(u32 port)
 		fail("Failed to listen to gdb socket");
 
 	printf("Waiting for gdb to connect...\n");
+	len = sizeof saddr_client;
 	sock = accept(tmpsock, (struct sockaddr *)&saddr_client, &len);
 
 	if (sock < 0)
@@ -713,75 +1597,252 @@ void gdb_init(u32 port)
 	close(tmpsock);
 }
 
+// c becomes the next thread. it starts out paused and stops with
+// SIGABRT once its thread gets to run it.
+void gdb_add_thread(struct ctx_t *c)
+{
+	struct gdb_thread *t;
 
+	if (sock == -1)
+		return;
+	if (n_threads == GDB_MAX_THREADS)
+		fail("gdb: too many threads");
+
+	t = calloc(1, sizeof *t);
+	if (t == NULL)
+		fail("gdb: out of memory");
+	t->id = n_threads + 1;
+	t->ctx = c;
+	t->state = GDB_RUNNING;
+	pthread_cond_init(&t->resume, NULL);
+	c->paused = 1;
+
+	pthread_mutex_lock(&gdb_lock);
+	threads[n_threads++] = t;
+	if (g_thread == NULL)
+		g_thread = t;
+	pthread_mutex_unlock(&gdb_lock);
+}
+
+// waits for every thread to stop or exit before gdb gets to see them
+void gdb_start(void)
+{
+	u32 i;
+
+	if (sock == -1)
+		return;
+
+	pthread_mutex_lock(&gdb_lock);
+	for (;;) {
+		for (i = 0; i < n_threads && threads[i]->state != GDB_RUNNING; i++)
+			;
+		if (i == n_threads)
+			break;
+		pthread_cond_wait(&stopped, &gdb_lock);
+	}
+	pthread_mutex_unlock(&gdb_lock);
+
+	server_quit = 0;
+	if (pthread_create(&server, NULL, gdb_server, NULL) != 0)
+		fail("Failed to start the gdb server thread");
+	serving = 1;
+}
+
+// the calling thread is done with its context
+void gdb_exit_thread(void)
+{
+	struct gdb_thread *t;
+
+	if (sock == -1 || (t = gdb_self()) == NULL)
+		return;
+
+	pthread_mutex_lock(&gdb_lock);
+	t->state = GDB_EXITED;
+	if (t->stop_req) {
+		t->stop_req = 0;
+		gdb_interrupt--;
+	}
+	if (g_thread == t)
+		g_thread = gdb_thread_find(0);
+	if (c_thread == t)
+		c_thread = NULL;
+	pthread_cond_broadcast(&stopped);
+	if (waiting && g_thread == NULL) {
+		waiting = 0;
+		gdb_reply("W00");
+	}
+	pthread_mutex_unlock(&gdb_lock);
+}
+
+// the threads stay, context threads may still be waiting in them when
+// gdb kills the program
 void gdb_deinit(void)
 {
 	if (sock == -1)
 		return;
 
+	server_quit = 1;
+	shutdown(sock, 2);
+	if (serving && !pthread_equal(server, pthread_self()))
+		pthread_join(server, NULL);
+	serving = 0;
+
 	close(sock);
 	sock = -1;
+	rx_pos = rx_len = tx_len = 0;
+	no_ack = 0;
 #ifdef _WIN32
 	WSACleanup();
 #endif
 }
 
+// whether a debugger may look at single instructions
+int gdb_active(void)
+{
+	return sock != -1;
+}
+
+// waits until gdb resumes the calling thread's context. only called
+// while the context is paused.
 void gdb_handle_events(void)
 {
-	if (sock == -1)
+	struct gdb_thread *t;
+
+	if (sock == -1 || (t = gdb_self()) == NULL)
 		return;
 
-	while (gdb_data_available()) {
-		gdb_read_command();
-		gdb_parse_command();
+	pthread_mutex_lock(&gdb_lock);
+	while (t->state == GDB_STOPPED)
+		pthread_cond_wait(&t->resume, &gdb_lock);
+	pthread_mutex_unlock(&gdb_lock);
+}
+
+// stops the context if gdb asked the calling thread to stop while it was
+// running
+void gdb_break(void)
+{
+	struct gdb_thread *t;
+
+	if (sock == -1 || (t = gdb_self()) == NULL)
+		return;
+
+	pthread_mutex_lock(&gdb_lock);
+	if (t->stop_req && t->state == GDB_RUNNING) {
+		ctx->paused = 1;
+		gdb_stopped(t, t->stop_sig);
 	}
+	pthread_mutex_unlock(&gdb_lock);
 }
 
 int gdb_signal(u32 s)
 {
-	if (sock == -1)
+	struct gdb_thread *t;
+
+	if (sock == -1 || (t = gdb_self()) == NULL)
 		return 1;
 
-	sig = s;
+	pthread_mutex_lock(&gdb_lock);
+	gdb_stopped(t, s);
+	pthread_mutex_unlock(&gdb_lock);
+	return 0;
+}
 
-	if (send_signal) {
-		gdb_handle_signal();
-		send_signal = 0;
+// all active breakpoints, for snapshots
+u32 gdb_bp_list(struct gdb_bp *bp, u32 max)
+{
+	static const u32 types[] = {GDB_BP_TYPE_X, GDB_BP_TYPE_R, GDB_BP_TYPE_W, GDB_BP_TYPE_A};
+	gdb_bp_t *p[] = {bp_x, bp_r, bp_w, bp_a};
+	u32 i, j, n;
+
+	n = 0;
+	pthread_rwlock_rdlock(&bp_lock);
+	for (i = 0; i < array_size(types); i++) {
+		for (j = 0; j < GDB_MAX_BP && n < max; j++) {
+			if (p[i][j].active == 0)
+				continue;
+			bp[n].type = types[i];
+			bp[n].addr = p[i][j].addr;
+			bp[n].len = p[i][j].len;
+			n++;
+		}
 	}
+	pthread_rwlock_unlock(&bp_lock);
 
-	return 0;
+	return n;
+}
+
+int gdb_bp_set(u32 type, u32 addr, u32 len)
+{
+	gdb_bp_t *bp;
+
+	pthread_rwlock_wrlock(&bp_lock);
+	bp = gdb_bp_empty_slot(type);
+	if (bp != NULL) {
+		bp->active = 1;
+		bp_count++;
+		bp->addr = addr;
+		bp->len = len;
+	}
+	pthread_rwlock_unlock(&bp_lock);
+	return bp != NULL ? 0 : -1;
 }
 
 int gdb_bp_x(u32 addr)
 {
-	if (sock == -1)
+	struct gdb_thread *t;
+
+	if (sock == -1 || reverse_replaying || (t = gdb_self()) == NULL)
 		return 0;
 
+	t->watch_skip = t->resumed;
+	t->resumed = 0;
+
+	// the first instruction of a step always runs, gdb steps off a
+	// breakpoint like that
+	if (t->stepping) {
+		if (t->step_first) {
+			t->step_first = 0;
+			return 0;
+		}
+		if (addr < t->step_start || addr >= t->step_end)
+			return 1;
+	}
+
 	return gdb_bp_check(addr, GDB_BP_TYPE_X);
 }
 
-int gdb_bp_r(u32 addr)
+static int gdb_wp_check(u32 addr, u32 type, const char *reason)
 {
-	if (sock == -1)
+	struct gdb_thread *t;
+
+	if (sock == -1 || (t = gdb_self()) == NULL)
 		return 0;
 
-	return gdb_bp_check(addr, GDB_BP_TYPE_R);
+	if (reverse_replaying) {
+		if (gdb_bp_check(addr, type))
+			sprintf(replay_reason, "%s:%x;", reason, addr);
+		return 0;
+	}
+
+	if (t->watch_skip || !gdb_bp_check(addr, type))
+		return 0;
+	sprintf(t->stop_reason, "%s:%x;", reason, addr);
+	return 1;
 }
 
-int gdb_bp_w(u32 addr)
+int gdb_bp_r(u32 addr)
 {
-	if (sock == -1)
-		return 0;
+	return gdb_wp_check(addr, GDB_BP_TYPE_R, "rwatch");
+}
 
-	return gdb_bp_check(addr, GDB_BP_TYPE_W);
+int gdb_bp_w(u32 addr)
+{
+	return gdb_wp_check(addr, GDB_BP_TYPE_W, "watch");
 }
 
 int gdb_bp_a(u32 addr)
 {
-	if (sock == -1)
-		return 0;
-
-	return gdb_bp_check(addr, GDB_BP_TYPE_A);
+	return gdb_wp_check(addr, GDB_BP_TYPE_A, "awatch");
 }
 
 
@@ -22,10 +22,28 @@ typedef enum {
 	GDB_BP_TYPE_A
 } gdb_bp_type;
 
+struct gdb_bp {
+	u32 type;
+	u32 addr;
+	u32 len;
+};
+
+struct ctx_t;
+
+// every context added is a gdb thread. the threads running them stop
+// through gdb_signal() and wait in gdb_handle_events() while paused.
 void gdb_init(u32 port);
+void gdb_add_thread(struct ctx_t *c);
+void gdb_start(void);
+void gdb_exit_thread(void);
 void gdb_deinit(void);
 
+extern volatile int gdb_interrupt;
+
+int gdb_active(void);
+
 void gdb_handle_events(void);
+void gdb_break(void);
 int gdb_signal(u32 signal);
 
 int gdb_bp_x(u32 addr);
@@ -33,4 +51,7 @@ int gdb_bp_r(u32 addr);
 int gdb_bp_w(u32 addr);
 int gdb_bp_a(u32 addr);
 
+u32 gdb_bp_list(struct gdb_bp *bp, u32 max);
+int gdb_bp_set(u32 type, u32 addr, u32 len);
+
 #endif
@@ -7,6 +7,8 @@
 #include "emulate.h"
 #include "main.h"
 #include "helper.h"
+#include "lockstep.h"
+#include "dirty.h"
 
 #ifndef DEBUG_INSTR_MEM
 #define vdbgprintf(...)
@@ -18,6 +20,8 @@
 void reg2ls(u32 r, u32 addr)
 {
 	addr &= LSLR & 0xfffffff0;
+	lockstep_store(addr);
+	dirty_mark(addr, 16);
 		vdbgprintf("  LS STORE: %05x: %08x %08x %08x %08x\n", addr, ctx->reg[r][0], ctx->reg[r][1], ctx->reg[r][2], ctx->reg[r][3]);
 	wbe32(ctx->ls + addr, ctx->reg[r][0]);
 	wbe32(ctx->ls + addr + 4, ctx->reg[r][1]);
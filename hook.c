@@ -0,0 +1,322 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "elf.h"
+#include "hook.h"
+#include "dirty.h"
+
+#define HOOK_MAX	64
+
+u32 hook_map[LS_SIZE / 4 / 32];
+
+static struct {
+	u32 addr;
+	hook_fn_t fn;
+} hooks[HOOK_MAX];
+static u32 n_hooks;
+
+// argument and return value helpers following the SPU ABI
+#define arg(n)	(ctx->reg[3 + (n)][0])
+
+static void ret(u32 v)
+{
+	ctx->reg[3][0] = v;
+	ctx->reg[3][1] = 0;
+	ctx->reg[3][2] = 0;
+	ctx->reg[3][3] = 0;
+}
+
+static float argf(int n)
+{
+	union { u32 u; float f; } v;
+
+	v.u = arg(n);
+	return v.f;
+}
+
+static void retf(float f)
+{
+	union { u32 u; float f; } v;
+
+	v.f = f;
+	ret(v.u);
+}
+
+static double argd(int n)
+{
+	union { u64 u; double d; } v;
+
+	v.u = ((u64)ctx->reg[3 + n][0] << 32) | ctx->reg[3 + n][1];
+	return v.d;
+}
+
+static void retd(double d)
+{
+	union { u64 u; double d; } v;
+
+	v.d = d;
+	ctx->reg[3][0] = v.u >> 32;
+	ctx->reg[3][1] = v.u;
+	ctx->reg[3][2] = 0;
+	ctx->reg[3][3] = 0;
+}
+
+// returns a host pointer for a guest buffer or NULL if it does not fit into
+// the local store
+static u8 *ls_range(u32 addr, u32 len)
+{
+	addr &= LSLR;
+	if (len > LS_SIZE - addr) {
+		fail("hook: %08x bytes at %08x exceed local storage", len, addr);
+		return NULL;
+	}
+	return ctx->ls + addr;
+}
+
+// ls_range for a buffer the hook writes to
+static u8 *ls_dest(u32 addr, u32 len)
+{
+	dirty_mark(addr, len);
+	return ls_range(addr, len);
+}
+
+static u8 *ls_str(u32 addr, u32 *len)
+{
+	u8 *p, *end;
+
+	addr &= LSLR;
+	p = ctx->ls + addr;
+	end = memchr(p, 0, LS_SIZE - addr);
+	if (end == NULL) {
+		fail("hook: unterminated string at %08x", addr);
+		return NULL;
+	}
+	*len = end - p;
+	return p;
+}
+
+// string.h
+static int hook_memcpy(void)
+{
+	u8 *d = ls_dest(arg(0), arg(2));
+	u8 *s = ls_range(arg(1), arg(2));
+
+	if (d == NULL || s == NULL)
+		return 1;
+	memmove(d, s, arg(2));
+	ret(arg(0));
+	return 0;
+}
+
+static int hook_memset(void)
+{
+	u8 *d = ls_dest(arg(0), arg(2));
+
+	if (d == NULL)
+		return 1;
+	memset(d, arg(1), arg(2));
+	ret(arg(0));
+	return 0;
+}
+
+static int hook_memcmp(void)
+{
+	u8 *a = ls_range(arg(0), arg(2));
+	u8 *b = ls_range(arg(1), arg(2));
+
+	if (a == NULL || b == NULL)
+		return 1;
+	ret(memcmp(a, b, arg(2)));
+	return 0;
+}
+
+static int hook_strlen(void)
+{
+	u32 len;
+
+	if (ls_str(arg(0), &len) == NULL)
+		return 1;
+	ret(len);
+	return 0;
+}
+
+static int hook_strcpy(void)
+{
+	u32 len;
+	u8 *s, *d;
+
+	s = ls_str(arg(1), &len);
+	if (s == NULL)
+		return 1;
+	d = ls_dest(arg(0), len + 1);
+	if (d == NULL)
+		return 1;
+	memmove(d, s, len + 1);
+	ret(arg(0));
+	return 0;
+}
+
+static int hook_strcmp(void)
+{
+	u32 la, lb;
+	u8 *a, *b;
+
+	a = ls_str(arg(0), &la);
+	b = ls_str(arg(1), &lb);
+	if (a == NULL || b == NULL)
+		return 1;
+	ret(strcmp((char *)a, (char *)b));
+	return 0;
+}
+
+static int hook_strncmp(void)
+{
+	u8 *a = ls_range(arg(0), 0);
+	u8 *b = ls_range(arg(1), 0);
+	u32 n = arg(2);
+
+	if (n > LS_SIZE - (arg(0) & LSLR))
+		n = LS_SIZE - (arg(0) & LSLR);
+	if (n > LS_SIZE - (arg(1) & LSLR))
+		n = LS_SIZE - (arg(1) & LSLR);
+	ret(strncmp((char *)a, (char *)b, n));
+	return 0;
+}
+
+static int hook_strchr(void)
+{
+	u32 len;
+	u8 *s, *p;
+
+	s = ls_str(arg(0), &len);
+	if (s == NULL)
+		return 1;
+	p = memchr(s, arg(1) & 0xff, len + 1);
+	ret(p == NULL ? 0 : (u32)(p - ctx->ls));
+	return 0;
+}
+
+// math.h, single precision
+#define HOOK_F1(f) static int hook_##f(void) { retf(f(argf(0))); return 0; }
+#define HOOK_F2(f) static int hook_##f(void) { retf(f(argf(0), argf(1))); return 0; }
+// math.h, double precision
+#define HOOK_D1(f) static int hook_##f(void) { retd(f(argd(0))); return 0; }
+#define HOOK_D2(f) static int hook_##f(void) { retd(f(argd(0), argd(1))); return 0; }
+
+HOOK_F1(sqrtf) HOOK_F1(fabsf) HOOK_F1(floorf) HOOK_F1(ceilf)
+HOOK_F1(sinf) HOOK_F1(cosf) HOOK_F1(tanf) HOOK_F1(expf) HOOK_F1(logf)
+HOOK_F2(powf) HOOK_F2(atan2f) HOOK_F2(fmodf)
+
+HOOK_D1(sqrt) HOOK_D1(fabs) HOOK_D1(floor) HOOK_D1(ceil)
+HOOK_D1(sin) HOOK_D1(cos) HOOK_D1(tan) HOOK_D1(exp) HOOK_D1(log)
+HOOK_D2(pow) HOOK_D2(atan2) HOOK_D2(fmod)
+
+#define B(f) { #f, hook_##f }
+
+static const struct {
+	const char *name;
+	hook_fn_t fn;
+} builtins[] = {
+	B(memcpy), { "memmove", hook_memcpy }, B(memset), B(memcmp),
+	B(strlen), B(strcpy), B(strcmp), B(strncmp), B(strchr),
+	B(sqrtf), B(fabsf), B(floorf), B(ceilf), B(sinf), B(cosf), B(tanf),
+	B(expf), B(logf), B(powf), B(atan2f), B(fmodf),
+	B(sqrt), B(fabs), B(floor), B(ceil), B(sin), B(cos), B(tan),
+	B(exp), B(log), B(pow), B(atan2), B(fmod),
+};
+
+#undef B
+
+int hook_add(u32 addr, hook_fn_t fn)
+{
+	u32 i;
+
+	addr &= LSLR & ~3;
+
+	for (i = 0; i < n_hooks; i++)
+		if (hooks[i].addr == addr)
+			break;
+
+	if (i == n_hooks) {
+		if (n_hooks == HOOK_MAX)
+			return -1;
+		n_hooks++;
+	}
+
+	hooks[i].addr = addr;
+	hooks[i].fn = fn;
+	hook_map[addr >> 7] |= 1 << ((addr >> 2) & 31);
+	dbgprintf("hook: %08x\n", addr);
+	return 0;
+}
+
+int hook_add_sym(const char *name, hook_fn_t fn)
+{
+	const struct elf_sym *s;
+
+	s = elf_sym_by_name(name);
+	if (s == NULL)
+		return -1;
+
+	return hook_add(s->addr, fn);
+}
+
+hook_fn_t hook_builtin(const char *name)
+{
+	u32 i;
+
+	for (i = 0; i < array_size(builtins); i++)
+		if (strcmp(builtins[i].name, name) == 0)
+			return builtins[i].fn;
+
+	return NULL;
+}
+
+// hooks every builtin whose symbol is present in the loaded elf
+int hook_add_builtins(void)
+{
+	u32 i;
+	int n = 0;
+
+	for (i = 0; i < array_size(builtins); i++)
+		if (hook_add_sym(builtins[i].name, builtins[i].fn) == 0)
+			n++;
+
+	return n;
+}
+
+void hook_clear(void)
+{
+	memset(hook_map, 0, sizeof hook_map);
+	memset(hooks, 0, sizeof hooks);
+	n_hooks = 0;
+}
+
+int hook_run(u32 addr)
+{
+	u32 i;
+	int res;
+
+	for (i = 0; i < n_hooks; i++) {
+		if (hooks[i].addr != addr)
+			continue;
+
+		res = hooks[i].fn();
+		if (res != 0)
+			return res;
+
+		ctx->pc = ctx->reg[0][0] & LSLR & ~3;
+		return 0;
+	}
+
+	fail("hook: no hook registered at %08x", addr);
+	return 1;
+}
@@ -0,0 +1,30 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef HOOK_H__
+#define HOOK_H__
+
+#include "types.h"
+#include "config.h"
+
+// a hook replaces the guest function at its address. it reads its
+// arguments from r3-r10, leaves the result in r3 and the emulator returns
+// through $lr afterwards. a non-zero return value stops emulation.
+typedef int (*hook_fn_t)(void);
+
+extern u32 hook_map[LS_SIZE / 4 / 32];
+
+int hook_add(u32 addr, hook_fn_t fn);
+int hook_add_sym(const char *name, hook_fn_t fn);
+hook_fn_t hook_builtin(const char *name);
+int hook_add_builtins(void);
+void hook_clear(void);
+int hook_run(u32 addr);
+
+static inline int hook_check(u32 addr)
+{
+	return (hook_map[addr >> 7] >> ((addr >> 2) & 31)) & 1;
+}
+
+#endif
@@ -0,0 +1,467 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "elf.h"
+#include "image.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define IMAGE_HDR	36
+
+// directory for image cache files, none if not set
+const char *image_cache = NULL;
+
+static struct image *images;
+static pthread_mutex_t images_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a, and djb2 in *check
+static u64 hash_file(const u8 *p, u32 len, u32 *check)
+{
+	u64 h = 0xcbf29ce484222325ULL;
+	u32 c = 5381;
+	u32 i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+		c = c * 33 + p[i];
+	}
+	*check = c;
+	return h;
+}
+
+// read up to EOF, path may be a pipe that can't tell its size
+static u8 *read_file(const char *path, u32 *size)
+{
+	FILE *fp;
+	u8 *data, *p;
+	u32 len, max;
+	size_t n;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		fail("Unable to load elf");
+		return NULL;
+	}
+
+	data = NULL;
+	len = max = 0;
+	do {
+		if (len == max) {
+			max = max ? max * 2 : 0x10000;
+			p = max > 0x40000000 ? NULL : realloc(data, max);
+			if (p == NULL) {
+				fail("Unable to read %s", path);
+				goto err;
+			}
+			data = p;
+		}
+		n = fread(data + len, 1, max - len, fp);
+		len += n;
+	} while (n != 0);
+
+	if (ferror(fp)) {
+		fail("Unable to read %s", path);
+		goto err;
+	}
+	fclose(fp);
+
+	*size = len;
+	return data;
+
+err:
+	free(data);
+	fclose(fp);
+	return NULL;
+}
+
+static void image_free(struct image *img)
+{
+	u32 i;
+
+	for (i = 0; i < img->n_syms; i++)
+		free(img->syms[i].name);
+	free(img->syms);
+	free(img->segs);
+	free(img->ls);
+	free(img->path);
+	free(img);
+}
+
+static void cache_path(char *bfr, u32 size, u64 hash)
+{
+	if ((u32)snprintf(bfr, size, "%s/%016llx.img", image_cache, hash) >= size)
+		fail("image: path too long: %s", image_cache);
+}
+
+static void cache_unmap(u8 *map, u32 size)
+{
+#ifndef _WIN32
+	munmap(map, size);
+#else
+	(void)size;
+	free(map);
+#endif
+}
+
+// maps the cache file of img->hash, returns 0 if there is no usable one
+static int cache_load(struct image *img)
+{
+	char path[1024];
+	struct stat st;
+	u32 n_segs, n_syms, str_size, i;
+	u8 hdr[IMAGE_HDR];
+	u8 *map, *p;
+	char *strtab;
+	int fd;
+
+	cache_path(path, sizeof path, img->hash);
+	fd = open(path, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return 0;
+
+	if (fstat(fd, &st) < 0 || read(fd, hdr, sizeof hdr) != sizeof hdr ||
+	    memcmp(hdr, IMAGE_MAGIC, 4) != 0 || be32(hdr + 4) != IMAGE_VERSION ||
+	    be64(hdr + 8) != img->hash || be32(hdr + 28) != img->size ||
+	    be32(hdr + 32) != img->check)
+		goto bad;
+
+	n_segs = be32(hdr + 20);
+	n_syms = be32(hdr + 24);
+	if (st.st_size < IMAGE_LS_OFFSET + LS_SIZE + 4)
+		goto bad;
+
+#ifndef _WIN32
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto bad;
+#else
+	map = malloc(st.st_size);
+	if (map == NULL || lseek(fd, 0, SEEK_SET) != 0 || read(fd, map, st.st_size) != st.st_size) {
+		free(map);
+		goto bad;
+	}
+#endif
+#ifndef _WIN32
+	img->fd = fd;
+	img->ls_offset = IMAGE_LS_OFFSET;
+#else
+	close(fd);
+#endif
+
+	p = map + IMAGE_LS_OFFSET + LS_SIZE;
+	str_size = be32(p);
+	p += 4;
+	if ((u64)st.st_size != (u64)(p - map) + 8ULL * n_segs + 12ULL * n_syms + str_size ||
+	    str_size == 0)
+		goto corrupt;
+	strtab = (char *)p + 8 * n_segs + 12 * n_syms;
+	if (strtab[str_size - 1] != 0)
+		goto corrupt;
+
+	img->entry = be32(hdr + 16);
+	img->ls = map + IMAGE_LS_OFFSET;
+	img->n_segs = n_segs;
+	img->n_syms = n_syms;
+	img->segs = malloc((n_segs ? n_segs : 1) * sizeof *img->segs);
+	img->syms = malloc((n_syms ? n_syms : 1) * sizeof *img->syms);
+	if (img->segs == NULL || img->syms == NULL)
+		goto corrupt;
+
+	for (i = 0; i < n_segs; i++, p += 8) {
+		img->segs[i].addr = be32(p);
+		img->segs[i].size = be32(p + 4);
+		if (img->segs[i].addr > LS_SIZE || img->segs[i].size > LS_SIZE - img->segs[i].addr)
+			goto corrupt;
+	}
+	for (i = 0; i < n_syms; i++, p += 12) {
+		img->syms[i].addr = be32(p);
+		img->syms[i].size = be32(p + 4);
+		if (be32(p + 8) >= str_size)
+			goto corrupt;
+		img->syms[i].name = strtab + be32(p + 8);
+	}
+
+	dbgprintf("image: mapped %s\n", path);
+	return 1;
+
+corrupt:
+	printf("image: ignoring corrupt cache file %s\n", path);
+	if (img->fd >= 0)
+		close(img->fd);
+	img->fd = -1;
+	free(img->segs);
+	free(img->syms);
+	img->segs = NULL;
+	img->syms = NULL;
+	img->n_segs = img->n_syms = 0;
+	cache_unmap(map, st.st_size);
+	return 0;
+
+bad:
+	close(fd);
+	return 0;
+}
+
+// writes the cache file for img, next to it first so that other processes
+// never see half of it
+static void cache_save(const struct image *img)
+{
+	char path[1024], tmp[1040];
+	u32 str_size, i;
+	u8 *hdr, rec[12];
+	FILE *fp;
+
+#ifdef _WIN32
+	mkdir(image_cache);
+#else
+	mkdir(image_cache, 0777);
+#endif
+	cache_path(path, sizeof path, img->hash);
+	snprintf(tmp, sizeof tmp, "%s.%u", path, (u32)getpid());
+
+	hdr = calloc(1, IMAGE_LS_OFFSET);
+	if (hdr == NULL)
+		return;
+
+	str_size = 1;
+	for (i = 0; i < img->n_syms; i++)
+		str_size += strlen(img->syms[i].name) + 1;
+
+	memcpy(hdr, IMAGE_MAGIC, 4);
+	wbe32(hdr + 4, IMAGE_VERSION);
+	wbe64(hdr + 8, img->hash);
+	wbe32(hdr + 16, img->entry);
+	wbe32(hdr + 20, img->n_segs);
+	wbe32(hdr + 24, img->n_syms);
+	wbe32(hdr + 28, img->size);
+	wbe32(hdr + 32, img->check);
+
+	fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		printf("image: unable to create %s, not caching\n", tmp);
+		free(hdr);
+		return;
+	}
+	fwrite(hdr, IMAGE_LS_OFFSET, 1, fp);
+	fwrite(img->ls, LS_SIZE, 1, fp);
+	wbe32(rec, str_size);
+	fwrite(rec, 4, 1, fp);
+	for (i = 0; i < img->n_segs; i++) {
+		wbe32(rec, img->segs[i].addr);
+		wbe32(rec + 4, img->segs[i].size);
+		fwrite(rec, 8, 1, fp);
+	}
+	str_size = 1;
+	for (i = 0; i < img->n_syms; i++) {
+		wbe32(rec, img->syms[i].addr);
+		wbe32(rec + 4, img->syms[i].size);
+		wbe32(rec + 8, str_size);
+		fwrite(rec, 12, 1, fp);
+		str_size += strlen(img->syms[i].name) + 1;
+	}
+	fputc(0, fp);
+	for (i = 0; i < img->n_syms; i++)
+		fwrite(img->syms[i].name, strlen(img->syms[i].name) + 1, 1, fp);
+
+	if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+		printf("image: unable to write %s, not caching\n", path);
+		unlink(tmp);
+	}
+	free(hdr);
+}
+
+// moves the local store of a freshly parsed image to an unlinked temporary
+// file, from where image_map() can map it
+static void image_share(struct image *img)
+{
+#ifndef _WIN32
+	FILE *fp;
+	u8 *ls;
+	int fd;
+
+	fp = tmpfile();
+	if (fp == NULL)
+		return;
+	fd = dup(fileno(fp));
+	fclose(fp);
+	if (fd < 0)
+		return;
+
+	if (write(fd, img->ls, LS_SIZE) != LS_SIZE ||
+	    (ls = mmap(NULL, LS_SIZE, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return;
+	}
+
+	free(img->ls);
+	img->ls = ls;
+	img->fd = fd;
+	img->ls_offset = 0;
+#else
+	(void)img;
+#endif
+}
+
+// the mtime of a regular file in ns, -1 if there is none good enough to
+// tell two writes in the same second apart
+static s64 file_mtime(const struct stat *st)
+{
+#ifdef _WIN32
+	(void)st;
+	return -1;
+#else
+	if (!S_ISREG(st->st_mode))
+		return -1;
+	return (s64)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+static void image_stat(struct image *img, const struct stat *st)
+{
+	img->dev = st->st_dev;
+	img->ino = st->st_ino;
+	img->mtime = file_mtime(st);
+}
+
+// the image first loaded from path, if it is still the same file with the
+// size and mtime it had then. called with images_lock held.
+static struct image *image_find_path(const char *path, const struct stat *st)
+{
+	struct image *img;
+	s64 mtime;
+
+	mtime = file_mtime(st);
+	if (mtime < 0)
+		return NULL;
+	for (img = images; img != NULL; img = img->next)
+		if (img->mtime == mtime && img->ino == (u64)st->st_ino &&
+		    img->dev == (u64)st->st_dev && (off_t)img->size == st->st_size &&
+		    strcmp(img->path, path) == 0)
+			return img;
+	return NULL;
+}
+
+// returns the program in the ELF file at path, loading it only if no
+// context of this process (or, with image_cache, any earlier process)
+// loaded the same file before. NULL if it can't be loaded.
+const struct image *image_get(const char *path)
+{
+	struct image *img;
+	struct stat st;
+	u8 *data;
+	u32 size, check;
+	u64 hash;
+
+	// the same unchanged file again isn't read at all. stat first, a
+	// file written after it gets another mtime and is read next time.
+	if (stat(path, &st) == 0) {
+		pthread_mutex_lock(&images_lock);
+		img = image_find_path(path, &st);
+		pthread_mutex_unlock(&images_lock);
+		if (img != NULL)
+			return img;
+	} else {
+		memset(&st, 0, sizeof st);
+	}
+
+	data = read_file(path, &size);
+	if (data == NULL)
+		return NULL;
+	hash = hash_file(data, size, &check);
+
+	pthread_mutex_lock(&images_lock);
+	for (img = images; img != NULL; img = img->next)
+		if (img->hash == hash && img->size == size && img->check == check)
+			break;
+
+	// only touched, or written back as it was
+	if (img != NULL && strcmp(img->path, path) == 0)
+		image_stat(img, &st);
+
+	if (img == NULL) {
+		img = calloc(1, sizeof *img);
+		if (img == NULL) {
+			fail("image: out of memory");
+			goto out;
+		}
+		img->hash = hash;
+		img->check = check;
+		img->size = size;
+		image_stat(img, &st);
+		img->path = strdup(path);
+		img->fd = -1;
+		if (img->path == NULL) {
+			image_free(img);
+			img = NULL;
+			fail("image: out of memory");
+			goto out;
+		}
+
+		if (image_cache == NULL || !cache_load(img)) {
+			img->ls = calloc(1, LS_SIZE);
+			if (img->ls == NULL || elf_parse(path, data, size, img) < 0) {
+				image_free(img);
+				img = NULL;
+				goto out;
+			}
+			if (image_cache != NULL)
+				cache_save(img);
+			image_share(img);
+		}
+
+		img->next = images;
+		images = img;
+	}
+out:
+	pthread_mutex_unlock(&images_lock);
+
+	free(data);
+	return img;
+}
+
+// returns a private local store that starts out as the one of img. the
+// pages stay shared with the image until the context writes to them.
+u8 *image_map(const struct image *img)
+{
+	u8 *ls;
+
+#ifndef _WIN32
+	if (img->fd >= 0) {
+		ls = mmap(NULL, LS_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, img->fd, img->ls_offset);
+		return ls == MAP_FAILED ? NULL : ls;
+	}
+#endif
+	ls = malloc(LS_SIZE);
+	if (ls != NULL)
+		memcpy(ls, img->ls, LS_SIZE);
+	return ls;
+}
+
+void image_unmap(const struct image *img, u8 *ls)
+{
+#ifndef _WIN32
+	if (img->fd >= 0) {
+		munmap(ls, LS_SIZE);
+		return;
+	}
+#endif
+	free(ls);
+}
@@ -0,0 +1,57 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef IMAGE_H__
+#define IMAGE_H__
+
+#include "types.h"
+#include "elf.h"
+
+// a loaded program: the local store as the ELF leaves it, the LOAD
+// segments, the entry point and the symbols. images are shared read only
+// by every context running the program and live until the process exits.
+// the local store lives in a file (the cache file or an unlinked
+// temporary one) so that contexts can map it copy-on-write.
+//
+// cache file layout (big endian), <cache dir>/<hash>.img:
+//   header: "ANIM", version, content hash (u64), entry, segment count,
+//           symbol count, ELF file size, second content hash (u32)
+//   zero padding up to IMAGE_LS_OFFSET
+//   the local store
+//   string table size, addr/size per segment, addr/size/name offset per
+//   symbol, the string table
+#define IMAGE_MAGIC	"ANIM"
+#define IMAGE_VERSION	2
+#define IMAGE_LS_OFFSET	0x10000
+
+struct image_seg {
+	u32 addr;
+	u32 size;
+};
+
+struct image {
+	u64 hash;
+	u32 check;		// second hash of the file, guards against collisions
+	u32 size;		// of the ELF file
+	char *path;		// the file it was first loaded from
+	u64 dev, ino;		// and its stat() then, see image_get()
+	s64 mtime;		// ns, -1 if it wasn't a regular file
+	u32 entry;
+	u8 *ls;
+	int fd;			// backing file of ls, -1 if there is none
+	u32 ls_offset;		// where ls starts in it
+	struct image_seg *segs;
+	u32 n_segs;
+	struct elf_sym *syms;
+	u32 n_syms;
+	struct image *next;
+};
+
+extern const char *image_cache;
+
+const struct image *image_get(const char *path);
+u8 *image_map(const struct image *img);
+void image_unmap(const struct image *img, u8 *ls);
+
+#endif
@@ -18,7 +18,67 @@ types = {
 		"special": (11, "SPU_INSTR_SPECIAL", "u32 opcode"),
 	}
 
-optbl = [["NULL", "SPU_INSTR_NONE"]] * (1 << OPCODE_MAX)
+NONE = ["NULL", "SPU_INSTR_NONE", "NULL", "SPU_PIPE_NONE", "0", "0", "NULL"]
+optbl = [NONE] * (1 << OPCODE_MAX)
+
+flag_attributes = {
+		"rdrt": "INSTR_READS_RT",
+		"nort": "INSTR_NO_RT",
+		"nora": "INSTR_NO_RA",
+		"norb": "INSTR_NO_RB",
+		"branch": "INSTR_BRANCH",
+		"load": "INSTR_LOAD",
+		"store": "INSTR_STORE",
+		"call": "INSTR_CALL",
+		"hint": "INSTR_HINT",
+		"stop": "INSTR_STOP",
+		"trap": "INSTR_TRAP",
+		"signed": "INSTR_SIGNED",
+	}
+
+# disassembler operands, asm= or what the format and register flags imply
+def operands(format, attributes):
+	for attrib in attributes:
+		if attrib[:4] == "asm=":
+			return attrib[4:].split(":")
+	if format == "special":
+		return []
+	if format == "rrr":
+		return ["rt", "ra", "rb", "rc"]
+	ops = []
+	if "nort" not in attributes or "rdrt" in attributes:
+		ops.append("rt")
+	if "load" in attributes or "store" in attributes:
+		if format == "rr":
+			return ops + ["ra", "rb"]
+		return ops + ["i(ra)"]
+	if format in ["rr", "ri7", "ri10"] and "nora" not in attributes:
+		ops.append("ra")
+	if format == "rr":
+		if "norb" not in attributes:
+			ops.append("rb")
+	else:
+		ops.append("i")
+	return ops
+
+def timing(attributes):
+	pipe = None
+	latency = 0
+	flags = []
+	for attrib in attributes:
+		if attrib == "even":
+			pipe = "SPU_PIPE_EVEN"
+		elif attrib == "odd":
+			pipe = "SPU_PIPE_ODD"
+		elif attrib[:3] == "lat":
+			latency = int(attrib[3:])
+		elif attrib in flag_attributes:
+			flags.append(flag_attributes[attrib])
+	assert pipe is not None, "missing pipeline for %s" % current_instruction
+	return [pipe, str(latency), " | ".join(flags) or "0"]
+
+def metadata(format, attributes):
+	return timing(attributes) + ['"%s"' % ",".join(operands(format, attributes))]
 
 def decorate(f):
 	return "instr_" + f
@@ -72,18 +132,20 @@ for line in tbl:
 	function_attributes[current_instruction] = line[3:]	
 	function_bodies[current_instruction] = None
 
+	entry = [decorate(current_instruction), type, '"%s"' % current_instruction] + metadata(line[1], line[3:])
+
 	for i in range(0, (1 << (OPCODE_MAX - l))):
-		if optbl[opcode + i] != ["NULL", "SPU_INSTR_NONE"]:
+		if optbl[opcode + i] != NONE:
 			a = optbl[opcode + i]
-			b = [decorate(current_instruction), type]
+			b = entry
 			print ("uh oh, would overwrite %s with %s" % (a, b))
 			fail = True
-		optbl = optbl[:opcode + i] + [[decorate(current_instruction), type]] + optbl[opcode + i + 1:]
+		optbl = optbl[:opcode + i] + [entry] + optbl[opcode + i + 1:]
 
 instrs = ""
 i = 0
 for op in optbl:
-	instrs = instrs + "\t{%s, %s}, // %08x\n" % (op[1], op[0], i << 25)
+	instrs = instrs + "\t{%s, %s, %s, %s, %s, %s, %s}, // %08x\n" % (op[1], op[0], op[2], op[3], op[4], op[5], op[6], i << 21)
 	i = i + 1
 
 if fail == True:
@@ -133,6 +195,8 @@ for fnc in function_bodies:
 			ret = 1
 		elif attrib == "trap":
 			trap = "if (ctx->trap) return 1;"
+		elif attrib in ["even", "odd"] or attrib[:3] == "lat" or attrib[:4] == "asm=" or attrib in flag_attributes:
+			pass
 		else:
 			assert None, "Unknown attrib %s" % attrib
 	
@@ -0,0 +1,165 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "engine.h"
+#include "lockstep.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
+#include "coverage.h"
+#include "profile.h"
+
+// quads stored by either side during one block. stores that bypass
+// reg2ls (DMA, hooks) and blocks with more stores than this are caught
+// by comparing the whole local store.
+#define LOCKSTEP_STORES	256
+// blocks between whole local store compares
+#define LOCKSTEP_FULL	65536
+// differing local store quads to print
+#define LOCKSTEP_REPORT	8
+
+int lockstep_enabled = 0;
+int lockstep_shadow = 0;
+
+static const struct engine *engine;
+static struct ctx_t shadow;
+static u32 stored[LOCKSTEP_STORES];
+static u32 n_stored;
+static u64 blocks;
+
+void lockstep_init(const struct engine *e)
+{
+	engine = e;
+	shadow = *ctx;
+	shadow.ls = malloc(LS_SIZE);
+	if (shadow.ls == NULL)
+		fail("lockstep: unable to allocate local storage");
+	memcpy(shadow.ls, ctx->ls, LS_SIZE);
+	lockstep_enabled = 1;
+}
+
+void lockstep_log(u32 addr)
+{
+	if (n_stored < LOCKSTEP_STORES)
+		stored[n_stored] = addr & LSLR & ~15;
+	n_stored++;
+}
+
+static void print_quad(const char *what, const u32 *a, const u32 *b)
+{
+	printf("  %-9s %08x %08x %08x %08x | %08x %08x %08x %08x\n", what,
+		a[0], a[1], a[2], a[3], b[0], b[1], b[2], b[3]);
+}
+
+static int compare_ls(u32 addr)
+{
+	u32 a[4], b[4];
+	char what[16];
+	int i;
+
+	if (memcmp(ctx->ls + addr, shadow.ls + addr, 16) == 0)
+		return 0;
+
+	for (i = 0; i < 4; i++) {
+		a[i] = be32(ctx->ls + addr + 4 * i);
+		b[i] = be32(shadow.ls + addr + 4 * i);
+	}
+	snprintf(what, sizeof what, "ls %05x", addr);
+	print_quad(what, a, b);
+	return 1;
+}
+
+// compares the contexts after a block, prints every difference found as
+// "reference | engine" and fails on any
+static void compare(u32 pc, u32 res, u32 res_shadow, int full)
+{
+	char what[16];
+	int diverged;
+	u32 i, n;
+
+	diverged = res != res_shadow || ctx->pc != shadow.pc;
+	for (i = 0; i < 128 && !diverged; i++)
+		diverged = memcmp(ctx->reg[i], shadow.reg[i], 16) != 0;
+	if (!diverged && !full && n_stored <= LOCKSTEP_STORES) {
+		for (i = 0; i < n_stored; i++)
+			if (memcmp(ctx->ls + stored[i], shadow.ls + stored[i], 16) != 0)
+				break;
+		if (i == n_stored)
+			return;
+	} else if (!diverged && memcmp(ctx->ls, shadow.ls, LS_SIZE) == 0) {
+		return;
+	}
+
+	printf("lockstep: %s diverged from %s in the block at %05x (block %llu)\n",
+		engine->name, engine_interp.name, pc, blocks);
+	printf("  %-9s %-35s | %s\n", "", engine_interp.name, engine->name);
+	if (res != res_shadow)
+		printf("  %-9s %-35u | %u\n", "result", res, res_shadow);
+	if (ctx->pc != shadow.pc)
+		printf("  %-9s %05x %29s | %05x\n", "pc", ctx->pc, "", shadow.pc);
+	for (i = 0; i < 128; i++) {
+		if (memcmp(ctx->reg[i], shadow.reg[i], 16) == 0)
+			continue;
+		snprintf(what, sizeof what, "$%u", i);
+		print_quad(what, ctx->reg[i], shadow.reg[i]);
+	}
+	for (i = 0, n = 0; i < LS_SIZE && n < LOCKSTEP_REPORT; i += 16)
+		n += compare_ls(i);
+
+	fail("lockstep: %s diverged at %05x", engine->name, pc);
+}
+
+u32 lockstep_block(void)
+{
+	struct ctx_t *ref;
+	int st, tm, tr, cv, pr;
+	u32 pc, res, res_shadow;
+
+	pc = ctx->pc;
+	n_stored = 0;
+	res = engine_interp.block();
+
+	// the engine under test runs uninstrumented on its own context
+	st = stats_enabled;
+	tm = timing_enabled;
+	tr = trace_enabled;
+	cv = coverage_enabled;
+	pr = profile_enabled;
+	stats_enabled = timing_enabled = trace_enabled = 0;
+	coverage_enabled = profile_enabled = 0;
+
+	ref = ctx;
+	ctx = &shadow;
+	lockstep_shadow = 1;
+	res_shadow = engine->block();
+	lockstep_shadow = 0;
+	ctx = ref;
+
+	stats_enabled = st;
+	timing_enabled = tm;
+	trace_enabled = tr;
+	coverage_enabled = cv;
+	profile_enabled = pr;
+
+	blocks++;
+	compare(pc, res, res_shadow, blocks % LOCKSTEP_FULL == 0);
+	return res;
+}
+
+// a last whole local store compare when the run ends
+void lockstep_finish(void)
+{
+	if (!lockstep_enabled)
+		return;
+	compare(ctx->pc, 0, 0, 1);
+	printf("lockstep: %s matched %s for %llu blocks\n",
+		engine->name, engine_interp.name, blocks);
+}
@@ -0,0 +1,26 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef LOCKSTEP_H__
+#define LOCKSTEP_H__
+
+#include "types.h"
+#include "engine.h"
+
+extern int lockstep_enabled;
+// set while the engine under test runs its copy of a block
+extern int lockstep_shadow;
+
+void lockstep_init(const struct engine *e);
+u32 lockstep_block(void);
+void lockstep_finish(void);
+void lockstep_log(u32 addr);
+
+static inline void lockstep_store(u32 addr)
+{
+	if (lockstep_enabled)
+		lockstep_log(addr);
+}
+
+#endif
@@ -7,6 +7,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 
 #include "types.h"
 #include "main.h"
@@ -14,12 +15,47 @@
 #include "elf.h"
 #include "emulate.h"
 #include "gdb.h"
+#include "hook.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
+#include "coverage.h"
+#include "profile.h"
+#include "replay.h"
+#include "engine.h"
+#include "lockstep.h"
+#include "snapshot.h"
+#include "batch.h"
+#include "image.h"
+#include "reverse.h"
+#include "aot.h"
 
 struct ctx_t _ctx;
-struct ctx_t *ctx;
+__thread struct ctx_t *ctx;
 
 static int gdb_port = -1;
 static const char *elf_path = NULL;
+static int native_hooks = 0;
+static const char *stats_path = NULL;
+static const char *timing_path = NULL;
+static const char *trace_path = NULL;
+static const char *coverage_prefix = NULL;
+static volatile sig_atomic_t coverage_request = 0;
+static u32 profile_period = 0;
+static int profile_cycles = 0;
+static const char *replay_path = NULL;
+static int replay = REPLAY_OFF;
+static const struct engine *engine = &engine_interp;
+static const struct engine *lockstep = NULL;
+static const char *aot_path = NULL;
+static int save_at_exit = 0;
+static const char *restore_path = NULL;
+static int ls_mapped = 0;
+static const char *batch_path = NULL;
+static const char *batch_output = BATCH_NAME;
+static u32 batch_threads = 0;
+static int reverse = 0;
+static u32 reverse_interval = 0;
 
 void dump_regs(void)
 {
@@ -41,12 +77,28 @@ void dump_ls(void)
 {
 	FILE *fp;
 
+	if (ctx->ls == NULL)
+		return;
+
 	printf("dumping local store to " DUMP_LS_NAME "\n");
 	fp = fopen(DUMP_LS_NAME, "wb");
 	fwrite(ctx->ls, LS_SIZE, 1, fp);
 	fclose(fp);
 }
 
+static void write_reports(void)
+{
+	if (stats_path != NULL)
+		stats_dump(stats_path);
+	if (timing_path != NULL)
+		timing_report(timing_path);
+	trace_close();
+	if (coverage_prefix != NULL)
+		coverage_dump(coverage_prefix);
+	profile_report(PROFILE_NAME);
+	replay_close();
+}
+
 void fail(const char *a, ...)
 {
 	char msg[1024];
@@ -54,6 +106,8 @@ void fail(const char *a, ...)
 
 	va_start(va, a);
 	vsnprintf(msg, sizeof msg, a, va);
+	va_end(va);
+	batch_fail(msg);
 	perror(msg);
 
 #ifdef FAIL_DUMP_REGS
@@ -64,34 +118,238 @@ void fail(const char *a, ...)
 	dump_ls();
 #endif
 
+	write_reports();
+
 	gdb_deinit();
 	exit(1);
 }
 
+#ifndef _WIN32
+static void coverage_signal(int s)
+{
+	(void)s;
+	coverage_request = 1;
+}
+#endif
+
 static void usage(void)
 {
-	printf("usage: anergistic [-g 1234] filename.elf\n");
+	u32 i;
+
+	printf("usage: anergistic [-g 1234] [-n] [--stats[=file]] [--timing[=file]]\n"
+	       "                  [--trace[=file]] [--coverage[=prefix]]\n"
+	       "                  [--profile[=period[c]]] [--record file | --replay file]\n"
+	       "                  [--engine=name] [--lockstep[=name]] [--aot=file]\n"
+	       "                  [--save[=file[@pc]]] [--restore=file] [--store=dir]\n"
+	       "                  [--batch=manifest [--jobs=n] [--output=file]]\n"
+	       "                  [--image-cache=dir] [--reverse[=interval]]\n"
+	       "                  [filename.elf]\n");
+	printf("  -g port\twait for gdb on port\n");
+	printf("  -n\t\treplace known library functions with native code\n");
+	printf("  --stats\twrite run statistics as JSON to " STATS_NAME " (or file, - for stdout)\n");
+	printf("  --timing\twrite estimated SPU cycles per function and block to " TIMING_NAME "\n");
+	printf("  --trace\trecord a binary execution trace to " TRACE_NAME " (see trace-decode)\n");
+	printf("  --coverage\twrite the executed instruction bitmap and branch edges to\n"
+	       "\t\t" COVERAGE_NAME ".bin/.txt (also on SIGUSR1)\n");
+	printf("  --profile\tsample the pc every period instructions (default %u), or\n"
+	       "\t\tmodelled cycles with c and --timing, into " PROFILE_NAME "\n", PROFILE_PERIOD);
+	printf("  --record\tlog channel reads and DMA GET data to file\n");
+	printf("  --replay\tfeed channel reads and DMA GET data back from a recorded file\n");
+	printf("  --engine\texecution engine:");
+	for (i = 0; engines[i] != NULL; i++)
+		printf(" %s", engines[i]->name);
+	printf("\n");
+	printf("  --lockstep\trun an engine (default %s) next to %s and stop at the\n"
+	       "\t\tfirst block where they differ\n", engine_interp.name, engine_interp.name);
+	printf("  --aot\t\tload the code of the program translated by aot-generate.py for\n"
+	       "\t\tthe %s engine\n", engine_aot.name);
+	printf("  --save\tsnapshot the machine to " SNAPSHOT_NAME " (or file) when the run ends,\n"
+	       "\t\tor when it reaches pc (hex). stop 0x%x and the gdb monitor command\n"
+	       "\t\tsnapshot save one as well\n", SNAPSHOT_STOP);
+	printf("  --restore\tstart from a snapshot instead of the ELF entry point; the ELF\n"
+	       "\t\tis only needed for symbols\n");
+	printf("  --store\tkeep snapshots as page manifests in a deduplicating page store\n");
+	printf("  --batch\trun every job of a manifest, one per line:\n"
+	       "\t\telf [in=file@lsa] [dma=file@ea] [out=lsa:len] [budget=instrs]\n");
+	printf("  --jobs\tworker threads for --batch (default: one per cpu)\n");
+	printf("  --output\twrite --batch results as JSON lines to file (default " BATCH_NAME ")\n");
+	printf("  --image-cache\tkeep loaded programs in dir, keyed by ELF contents, and map\n"
+	       "\t\tthem from there instead of loading them again\n");
+	printf("  --reverse\tkeep a history for gdb to step and continue backwards in,\n"
+	       "\t\twith a checkpoint every interval instructions (default %u)\n", REVERSE_INTERVAL);
 	exit(1);
 }
 
+static const struct option long_options[] = {
+	{"stats", optional_argument, NULL, 'S'},
+	{"timing", optional_argument, NULL, 'T'},
+	{"trace", optional_argument, NULL, 'R'},
+	{"coverage", optional_argument, NULL, 'C'},
+	{"profile", optional_argument, NULL, 'P'},
+	{"record", required_argument, NULL, 'E'},
+	{"replay", required_argument, NULL, 'Y'},
+	{"engine", required_argument, NULL, 'X'},
+	{"lockstep", optional_argument, NULL, 'L'},
+	{"aot", required_argument, NULL, 'A'},
+	{"save", optional_argument, NULL, 'V'},
+	{"restore", required_argument, NULL, 'O'},
+	{"store", required_argument, NULL, 'D'},
+	{"batch", required_argument, NULL, 'B'},
+	{"jobs", required_argument, NULL, 'J'},
+	{"output", required_argument, NULL, 'U'},
+	{"image-cache", required_argument, NULL, 'I'},
+	{"reverse", optional_argument, NULL, 'W'},
+	{NULL, 0, NULL, 0}
+};
+
 static void parse_args(int argc, char *argv[])
 {
 	int c;
 
-	while ((c = getopt(argc, argv, "g:")) != -1) {
+	while ((c = getopt_long(argc, argv, "g:n", long_options, NULL)) != -1) {
 		switch(c) {
 			case 'g':
 				gdb_port = strtol(optarg, NULL, 10);
 				break;
+			case 'n':
+				native_hooks = 1;
+				break;
+			case 'S':
+				stats_path = optarg ? optarg : STATS_NAME;
+				break;
+			case 'T':
+				timing_path = optarg ? optarg : TIMING_NAME;
+				break;
+			case 'R':
+				trace_path = optarg ? optarg : TRACE_NAME;
+				break;
+			case 'C':
+				coverage_prefix = optarg ? optarg : COVERAGE_NAME;
+				break;
+			case 'P':
+				profile_period = PROFILE_PERIOD;
+				if (optarg != NULL) {
+					char *end;
+
+					profile_period = strtoul(optarg, &end, 10);
+					profile_cycles = *end == 'c';
+					if (*optarg < '0' || *optarg > '9' || profile_period == 0 ||
+					    end[profile_cycles] != 0) {
+						printf("Invalid profile period: %s\n", optarg);
+						usage();
+					}
+				}
+				break;
+			case 'E':
+			case 'Y':
+				replay_path = optarg;
+				replay = c == 'E' ? REPLAY_RECORD : REPLAY_PLAY;
+				break;
+			case 'X':
+			case 'L':
+				if (c == 'L' && optarg == NULL) {
+					lockstep = &engine_interp;
+					break;
+				}
+				if (engine_find(optarg) == NULL) {
+					printf("Unknown engine: %s\n", optarg);
+					usage();
+				}
+				if (c == 'X')
+					engine = engine_find(optarg);
+				else
+					lockstep = engine_find(optarg);
+				break;
+			case 'A':
+				aot_path = optarg;
+				break;
+			case 'V':
+				if (optarg != NULL) {
+					char *at = strchr(optarg, '@');
+
+					if (at != NULL) {
+						*at = 0;
+						snapshot_at = strtoul(at + 1, NULL, 16) & LSLR & ~3;
+					}
+					if (*optarg)
+						snapshot_path = optarg;
+				}
+				save_at_exit = snapshot_at == ~0U;
+				break;
+			case 'O':
+				restore_path = optarg;
+				break;
+			case 'D':
+				snapshot_store = optarg;
+				break;
+			case 'B':
+				batch_path = optarg;
+				break;
+			case 'J':
+				batch_threads = strtoul(optarg, NULL, 10);
+				break;
+			case 'U':
+				batch_output = optarg;
+				break;
+			case 'I':
+				image_cache = optarg;
+				break;
+			case 'W':
+				reverse = 1;
+				if (optarg != NULL)
+					reverse_interval = strtoul(optarg, NULL, 10);
+				break;
 			default:
 				printf("Unknown argument: %c\n", c);
 				usage();
 		}
 	}
 
+	if ((engine == &engine_aot || lockstep == &engine_aot) && aot_path == NULL) {
+		printf("the %s engine needs --aot\n", engine_aot.name);
+		usage();
+	}
+
+	// cycles only exist with the timing model
+	if (profile_cycles && timing_path == NULL) {
+		printf("--profile=%uc needs --timing\n", profile_period);
+		usage();
+	}
+
+	// the history is that of one context
+	if (reverse && batch_path != NULL) {
+		printf("--reverse can't be combined with --batch\n");
+		usage();
+	}
+
+	// these are only set up for the context of a single program
+	if (batch_path != NULL && (native_hooks || stats_path != NULL || timing_path != NULL ||
+	    trace_path != NULL || coverage_prefix != NULL || profile_period != 0 ||
+	    replay != REPLAY_OFF || lockstep != NULL || save_at_exit || snapshot_at != ~0U ||
+	    restore_path != NULL || snapshot_store != NULL)) {
+		printf("-n, --stats, --timing, --trace, --coverage, --profile, --record,\n"
+		       "--replay, --lockstep, --save, --restore and --store can't be\n"
+		       "combined with --batch\n");
+		usage();
+	}
+
+	if (optind == argc && (restore_path != NULL || batch_path != NULL))
+		return;
 	if (optind != argc - 1)
 		usage();
 
+	if (lockstep != NULL && (gdb_port >= 0 || replay != REPLAY_OFF)) {
+		printf("--lockstep can't be combined with -g, --record or --replay\n");
+		usage();
+	}
+
+	// going back runs forward again, that has to take the same path
+	if (reverse && (gdb_port < 0 || replay != REPLAY_OFF || engine != &engine_interp)) {
+		printf("--reverse needs -g and the %s engine, and can't be combined with\n"
+		       "--record or --replay\n", engine_interp.name);
+		usage();
+	}
+
 	elf_path = argv[optind];
 }
 
@@ -102,6 +360,20 @@ int main(int argc, char *argv[])
 	ctx = &_ctx;
 	parse_args(argc, argv);
 
+	if (aot_path != NULL)
+		aot_load(aot_path);
+
+	if (batch_path != NULL) {
+		if (gdb_port >= 0)
+			gdb_init(gdb_port);
+		// the workers would all save to the same file, a job stops
+		// at stop 0x3ffe instead
+		snapshot_path = NULL;
+		done = batch_run(batch_path, batch_output, batch_threads, engine);
+		gdb_deinit();
+		return done;
+	}
+
 #if 0
 	u64 local_ptr;
 	
@@ -129,22 +401,60 @@ int main(int argc, char *argv[])
 		ctx->paused = 0;
 	} else {
 		gdb_init(gdb_port);
-		ctx->paused = 1;
+		gdb_add_thread(ctx);
 		gdb_signal(SIGABRT);
 	}
 
-	elf_load(elf_path);
+	if (elf_path != NULL)
+		elf_load(elf_path);
+	if (restore_path != NULL) {
+		u8 *ls = ctx->ls;
+
+		ls_mapped = snapshot_restore(restore_path);
+		if (ls_mapped)
+			free(ls);
+	}
+
+	if (stats_path != NULL)
+		stats_init();
+	if (timing_path != NULL)
+		timing_init();
+	if (profile_period != 0)
+		profile_init(profile_period, profile_cycles);
+	if (trace_path != NULL)
+		trace_open(trace_path);
+	if (replay_path != NULL)
+		replay_open(replay_path, replay);
+	if (coverage_prefix != NULL) {
+		coverage_init();
+#ifndef _WIN32
+		signal(SIGUSR1, coverage_signal);
+#endif
+	}
+
+	if (native_hooks)
+		printf("hooked %d library functions\n", hook_add_builtins());
+
+	if (lockstep != NULL)
+		lockstep_init(lockstep);
+	if (reverse)
+		reverse_init(reverse_interval);
 
+	gdb_start();
 	done = 0;
 
 	while(done == 0) {
 
 		if (ctx->paused == 0)
-			done = emulate();
+			done = lockstep_enabled ? lockstep_block() : engine->block();
+
+		// ^C from gdb, or another thread stopped in all-stop mode
+		if (gdb_interrupt)
+			gdb_break();
 
 		// data watchpoints
 		if (done == 2) {
-			ctx->paused = 0;
+			ctx->paused = 1;
 			gdb_signal(SIGTRAP);
 			done = 0;
 		}
@@ -164,12 +474,22 @@ int main(int argc, char *argv[])
 #endif
 		}
 
+		if (coverage_request) {
+			coverage_request = 0;
+			coverage_dump(coverage_prefix);
+		}
+
 		if (ctx->paused == 1)
 			gdb_handle_events();
 	}
 	printf("emulate() returned. we're done!\n");
+	lockstep_finish();
 	dump_ls();
-	free(ctx->ls);
+	write_reports();
+	if (save_at_exit)
+		snapshot_save(snapshot_path, ctx->pc);
+	if (!ls_mapped)
+		free(ctx->ls);
 	gdb_deinit();
 	return 0;
 }
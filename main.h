@@ -7,16 +7,47 @@
 
 #include "types.h"
 
+// effective address space for MFC DMA, when the host provides one
+struct ea_region {
+	u64 ea;
+	u32 size;
+	const u8 *data;
+};
+
+struct ea_map {
+	const struct ea_region *regions;
+	u32 n_regions;
+	void (*put)(struct ea_map *map, u64 ea, const u8 *data, u32 size);
+};
+
+struct mfc_t {
+	u32 lsa;
+	u32 eah;
+	u32 eal;
+	u32 size;
+	u32 tag_id;
+	u32 tag_mask;
+	u32 tag_stat;
+};
+
 struct ctx_t {
 	u8 *ls;
 	u32 reg[128][4];
 	u32 pc;
 	u32 paused;
 	u32 trap;
+	struct mfc_t mfc;
+	u64 dirty;
+	u32 ls_gen;		// see dirty.h
+	struct ctx_t *base;
+	int base_shared;	// base->ls is not ours, see dirty_share()
+	u64 instrs;
+	u32 stop_code;
+	struct ea_map *ea;
 };
 
-// evil global variable ahead
-extern struct ctx_t *ctx;
+// evil global variable ahead, one per thread
+extern __thread struct ctx_t *ctx;
 
 void fail(const char *a, ...);
 void dump_regs(void);
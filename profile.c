@@ -0,0 +1,318 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "elf.h"
+#include "emulate-instrs.h"
+#include "timing.h"
+#include "profile.h"
+
+#define STACK_MAX	256
+#define CHAIN_DEPTH	8
+#define CHAIN_SLOTS	4096
+#define REPORT_TOP	20
+
+int profile_enabled = 0;
+
+static u32 period;
+static int use_cycles;
+static u64 next_sample;
+static u32 countdown;
+static u64 samples;
+
+static u32 *pc_hist;
+static u32 *block_hist;
+static u32 block;
+static int block_end;
+
+// shadow call stack of function entry points
+static u32 stack[STACK_MAX];
+static u32 depth;
+
+static struct chain {
+	u32 depth;
+	u32 frames[CHAIN_DEPTH];
+	u64 count;
+} chains[CHAIN_SLOTS];
+static u64 chains_dropped;
+
+void profile_init(u32 p, int cycles)
+{
+	period = p ? p : 1;
+	use_cycles = cycles && timing_enabled;
+	countdown = period;
+	next_sample = period;
+	samples = 0;
+
+	pc_hist = calloc(LS_SIZE / 4, sizeof *pc_hist);
+	block_hist = calloc(LS_SIZE / 4, sizeof *block_hist);
+	if (pc_hist == NULL || block_hist == NULL)
+		fail("profile: unable to allocate histograms");
+
+	memset(chains, 0, sizeof chains);
+	chains_dropped = 0;
+
+	stack[0] = ctx->pc;
+	depth = 1;
+	block = ctx->pc;
+	block_end = 0;
+
+	profile_enabled = 1;
+}
+
+static void profile_chain(void)
+{
+	struct chain c;
+	u32 h, i, n;
+
+	memset(&c, 0, sizeof c);
+	c.depth = depth < CHAIN_DEPTH ? depth : CHAIN_DEPTH;
+	h = 2166136261u;
+	for (i = 0; i < c.depth; i++) {
+		c.frames[i] = stack[depth - 1 - i];
+		h = (h ^ c.frames[i]) * 16777619u;
+	}
+
+	for (n = 0; n < CHAIN_SLOTS; n++) {
+		struct chain *s = &chains[(h + n) % CHAIN_SLOTS];
+
+		if (s->count == 0) {
+			*s = c;
+			s->count = 1;
+			return;
+		}
+		if (s->depth == c.depth &&
+		    memcmp(s->frames, c.frames, c.depth * sizeof *c.frames) == 0) {
+			s->count++;
+			return;
+		}
+	}
+
+	chains_dropped++;
+}
+
+static void profile_sample(u32 pc)
+{
+	samples++;
+	pc_hist[pc >> 2]++;
+	block_hist[block >> 2]++;
+	profile_chain();
+}
+
+void profile_retire(u32 pc, u32 instr, u32 op)
+{
+	if (block_end) {
+		block = pc;
+		block_end = 0;
+	}
+
+	if (use_cycles) {
+		while (timing_cycle() >= next_sample) {
+			profile_sample(pc);
+			next_sample += period;
+		}
+	} else if (--countdown == 0) {
+		profile_sample(pc);
+		countdown = period;
+	}
+
+	if (!(instr_tbl[op].flags & INSTR_BRANCH) && ctx->pc == ((pc + 4) & LSLR))
+		return;
+	block_end = 1;
+
+	if (instr_tbl[op].flags & INSTR_CALL) {
+		if (depth < STACK_MAX)
+			stack[depth++] = ctx->pc;
+	} else if (instr_tbl[op].ptr == instr_bi && ((instr >> 7) & 0x7f) == 0) {
+		// bi $lr
+		if (depth > 1)
+			depth--;
+	}
+}
+
+static const char *profile_sym(u32 addr, char *buf, u32 len)
+{
+	const struct elf_sym *s = elf_sym_by_addr(addr);
+
+	if (s == NULL)
+		snprintf(buf, len, "%05x", addr);
+	else if (s->addr == addr)
+		snprintf(buf, len, "%s", s->name);
+	else
+		snprintf(buf, len, "%s+0x%x", s->name, addr - s->addr);
+	return buf;
+}
+
+struct func_samples {
+	const struct elf_sym *sym;
+	u64 self;
+	u64 total;
+};
+
+static int func_cmp(const void *a, const void *b)
+{
+	const struct func_samples *x = a;
+	const struct func_samples *y = b;
+
+	if (x->self != y->self)
+		return x->self > y->self ? -1 : 1;
+	if (x->total != y->total)
+		return x->total > y->total ? -1 : 1;
+	return 0;
+}
+
+static struct func_samples *func_get(struct func_samples *f, u32 *n, const struct elf_sym *s)
+{
+	u32 i;
+
+	for (i = 0; i < *n; i++)
+		if (f[i].sym == s)
+			return &f[i];
+	f[*n].sym = s;
+	return &f[(*n)++];
+}
+
+static void profile_report_functions(FILE *fp)
+{
+	struct func_samples *funcs;
+	const struct elf_sym *s, *seen[CHAIN_DEPTH];
+	u32 n = 0, i, j, k;
+
+	funcs = calloc(LS_SIZE / 4 + CHAIN_SLOTS * CHAIN_DEPTH, sizeof *funcs);
+	if (funcs == NULL)
+		return;
+
+	for (i = 0; i < LS_SIZE / 4; i++)
+		if (pc_hist[i] != 0)
+			func_get(funcs, &n, elf_sym_by_addr(i << 2))->self += pc_hist[i];
+
+	// inclusive samples as seen by the shadow call stack
+	for (i = 0; i < CHAIN_SLOTS; i++) {
+		if (chains[i].count == 0)
+			continue;
+		for (j = 0; j < chains[i].depth; j++) {
+			s = elf_sym_by_addr(chains[i].frames[j]);
+			seen[j] = s;
+			for (k = 0; k < j; k++)
+				if (seen[k] == s)
+					break;
+			if (k == j)
+				func_get(funcs, &n, s)->total += chains[i].count;
+		}
+	}
+
+	qsort(funcs, n, sizeof *funcs, func_cmp);
+
+	fprintf(fp, "\n%10s %7s %10s %7s  %s\n", "self", "", "total", "", "function");
+	for (i = 0; i < n && i < REPORT_TOP; i++)
+		fprintf(fp, "%10llu %6.2f%% %10llu %6.2f%%  %s\n",
+				funcs[i].self, 100.0 * funcs[i].self / samples,
+				funcs[i].total, 100.0 * funcs[i].total / samples,
+				funcs[i].sym ? funcs[i].sym->name : "??");
+
+	free(funcs);
+}
+
+static u32 top_index(u32 *hist, u32 *shown, u32 n)
+{
+	u32 best = LS_SIZE / 4;
+	u32 i, j;
+
+	for (i = 0; i < LS_SIZE / 4; i++) {
+		if (hist[i] == 0 || (best != LS_SIZE / 4 && hist[i] <= hist[best]))
+			continue;
+		for (j = 0; j < n; j++)
+			if (shown[j] == i)
+				break;
+		if (j == n)
+			best = i;
+	}
+
+	return best;
+}
+
+static void profile_report_blocks(FILE *fp)
+{
+	char name[256];
+	u32 shown[REPORT_TOP];
+	u32 n, i;
+
+	fprintf(fp, "\n%10s %7s  %s\n", "samples", "", "basic block");
+	for (n = 0; n < REPORT_TOP; n++) {
+		i = top_index(block_hist, shown, n);
+		if (i == LS_SIZE / 4)
+			break;
+		shown[n] = i;
+		fprintf(fp, "%10u %6.2f%%  %05x %s\n", block_hist[i],
+				100.0 * block_hist[i] / samples, i << 2,
+				profile_sym(i << 2, name, sizeof name));
+	}
+}
+
+static void profile_report_chains(FILE *fp)
+{
+	char name[256];
+	u32 shown[REPORT_TOP];
+	u32 n, i, j, best;
+
+	fprintf(fp, "\n%10s %7s  %s\n", "samples", "", "call stack (innermost first)");
+	for (n = 0; n < REPORT_TOP; n++) {
+		best = CHAIN_SLOTS;
+		for (i = 0; i < CHAIN_SLOTS; i++) {
+			if (chains[i].count == 0)
+				continue;
+			if (best != CHAIN_SLOTS && chains[i].count <= chains[best].count)
+				continue;
+			for (j = 0; j < n; j++)
+				if (shown[j] == i)
+					break;
+			if (j == n)
+				best = i;
+		}
+		if (best == CHAIN_SLOTS)
+			break;
+		shown[n] = best;
+
+		fprintf(fp, "%10llu %6.2f%% ", chains[best].count,
+				100.0 * chains[best].count / samples);
+		for (j = 0; j < chains[best].depth; j++)
+			fprintf(fp, " %s%s", j ? "<- " : "",
+					profile_sym(chains[best].frames[j], name, sizeof name));
+		fprintf(fp, "\n");
+	}
+
+	if (chains_dropped)
+		fprintf(fp, "(%llu samples with other call stacks not shown)\n", chains_dropped);
+}
+
+void profile_report(const char *path)
+{
+	FILE *fp;
+
+	if (!profile_enabled)
+		return;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror("profile: unable to open output");
+		return;
+	}
+
+	fprintf(fp, "samples: %llu (every %u %s)\n", samples, period,
+			use_cycles ? "cycles" : "instructions");
+
+	if (samples != 0) {
+		profile_report_functions(fp);
+		profile_report_blocks(fp);
+		profile_report_chains(fp);
+	}
+
+	fclose(fp);
+}
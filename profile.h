@@ -0,0 +1,18 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef PROFILE_H__
+#define PROFILE_H__
+
+#include "types.h"
+
+extern int profile_enabled;
+
+// samples every period retired instructions, or modelled cycles if cycles
+// is set (which requires the timing model)
+void profile_init(u32 period, int cycles);
+void profile_retire(u32 pc, u32 instr, u32 op);
+void profile_report(const char *path);
+
+#endif
@@ -15,9 +15,19 @@
 #include "config.h"
 #include "emulate.h"
 #include "helper.h"
+#include "hook.h"
+#include "coverage.h"
+#include "dirty.h"
+#include "image.h"
+#include "emulate-instrs.h"
+#include "disasm.h"
 
 struct ctx_t _ctx;
-struct ctx_t *ctx;
+__thread struct ctx_t *ctx;
+
+// reset snapshot and pages written since, kept across execute() calls
+static struct ctx_t *py_base;
+static u64 py_dirty;
 
 static PyObject *anergistic_execute(PyObject *self, PyObject *args)
 {
@@ -92,18 +102,275 @@ static PyObject *anergistic_execute(PyObject *self, PyObject *args)
 			}
 			Py_DECREF(pc);
 		}
-		if (PyErr_CheckSignals())
-			return NULL;
-		if (PyErr_Occurred())
+		// reset() has to restore what this run wrote, even if it failed
+		if (PyErr_CheckSignals() || PyErr_Occurred())
+		{
+			py_dirty |= ctx->dirty;
 			return NULL;
+		}
 	}
 
 	for (i = 0; i < 128; ++i)
 		reg_to_byte(registers + i * 16, i);
+	py_dirty |= ctx->dirty;
 
 	return PyInt_FromLong(ctx->pc);
 }
 
+static PyObject *anergistic_hook(PyObject *self, PyObject *args)
+{
+	unsigned int addr;
+	const char *name;
+	hook_fn_t fn;
+
+	(void)self;
+	if (!PyArg_ParseTuple(args, "Is", &addr, &name))
+		return NULL;
+
+	fn = hook_builtin(name);
+	if (fn == NULL)
+	{
+		PyErr_SetString(PyExc_KeyError, name);
+		return NULL;
+	}
+
+	if (hook_add(addr, fn) < 0)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "Too many hooks");
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *anergistic_unhook_all(PyObject *self, PyObject *args)
+{
+	(void)self;
+	(void)args;
+	hook_clear();
+	Py_RETURN_NONE;
+}
+
+static PyObject *anergistic_coverage_enable(PyObject *self, PyObject *args)
+{
+	(void)self;
+	(void)args;
+	if (!coverage_enabled)
+		coverage_init();
+	Py_RETURN_NONE;
+}
+
+static PyObject *anergistic_coverage_reset(PyObject *self, PyObject *args)
+{
+	(void)self;
+	(void)args;
+	if (coverage_enabled)
+		coverage_reset();
+	Py_RETURN_NONE;
+}
+
+// returns (bitmap, [(from, to, count), ...]) with one bitmap bit per LS word
+static PyObject *anergistic_coverage(PyObject *self, PyObject *args)
+{
+	const struct coverage_edge *edges;
+	unsigned char bitmap[sizeof coverage_map];
+	PyObject *list, *edge;
+	u32 n, i;
+
+	(void)self;
+	(void)args;
+	if (!coverage_enabled)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "Coverage is not enabled");
+		return NULL;
+	}
+
+	for (i = 0; i < sizeof bitmap; i++)
+		bitmap[i] = coverage_map[i / 4] >> (8 * (i % 4));
+
+	list = PyList_New(0);
+	if (list == NULL)
+		return NULL;
+
+	edges = coverage_edges(&n);
+	for (i = 0; i < n; i++)
+	{
+		if (edges[i].count == 0)
+			continue;
+		edge = Py_BuildValue("(IIK)", edges[i].from, edges[i].to, edges[i].count);
+		if (edge == NULL || PyList_Append(list, edge) < 0)
+		{
+			Py_XDECREF(edge);
+			Py_DECREF(list);
+			return NULL;
+		}
+		Py_DECREF(edge);
+	}
+
+	return Py_BuildValue("(s#N)", bitmap, (int)sizeof bitmap, list);
+}
+
+// sets up ctx for a (local store, registers) argument pair
+static int py_context(PyObject *args, unsigned char **regs)
+{
+	unsigned char *local_store, *registers;
+	Py_ssize_t local_store_size, registers_size;
+	int i;
+
+	if (!PyArg_ParseTuple(args, "w#w#",
+		&local_store, &local_store_size,
+		&registers, &registers_size))
+		return -1;
+
+	if ((int)local_store_size != 256 * 1024 || (int)registers_size != 128 * 16)
+	{
+		PyErr_SetString(PyExc_TypeError, "Expected a 256kb local storage and a 128*16 register string array");
+		return -1;
+	}
+
+	memset(&_ctx, 0, sizeof _ctx);
+	ctx = &_ctx;
+	ctx->ls = (unsigned char*)local_store;
+	for (i = 0; i < 128; ++i)
+		byte_to_reg(i, registers + i * 16);
+	ctx->base = py_base;
+	ctx->dirty = py_dirty;
+	*regs = registers;
+	return 0;
+}
+
+static PyObject *anergistic_snapshot(PyObject *self, PyObject *args)
+{
+	unsigned char *registers;
+
+	(void)self;
+	if (py_context(args, &registers) < 0)
+		return NULL;
+
+	dirty_snapshot();
+	if (PyErr_Occurred())
+		return NULL;
+	py_base = ctx->base;
+	py_dirty = 0;
+	Py_RETURN_NONE;
+}
+
+static PyObject *anergistic_reset(PyObject *self, PyObject *args)
+{
+	unsigned char *registers;
+	u32 n;
+	int i;
+
+	(void)self;
+	if (py_context(args, &registers) < 0)
+		return NULL;
+	if (py_base == NULL)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "reset() without snapshot()");
+		return NULL;
+	}
+
+	n = dirty_reset();
+	for (i = 0; i < 128; ++i)
+		reg_to_byte(registers + i * 16, i);
+	py_dirty = 0;
+	return PyInt_FromLong(n);
+}
+
+static PyObject *anergistic_dirty(PyObject *self, PyObject *args)
+{
+	unsigned int addr, len;
+
+	(void)self;
+	if (!PyArg_ParseTuple(args, "II", &addr, &len))
+		return NULL;
+
+	ctx = &_ctx;
+	ctx->dirty = py_dirty;
+	dirty_mark(addr, len);
+	py_dirty = ctx->dirty;
+	Py_RETURN_NONE;
+}
+
+static PyObject *anergistic_image(PyObject *self, PyObject *args)
+{
+	const struct image *img;
+	const char *path, *cache = NULL;
+
+	(void)self;
+	if (!PyArg_ParseTuple(args, "s|z", &path, &cache))
+		return NULL;
+
+	if (cache != NULL && (image_cache == NULL || strcmp(cache, image_cache) != 0))
+		image_cache = strdup(cache);
+	img = image_get(path);
+	if (img == NULL)
+		return NULL;
+	return Py_BuildValue("(Is#)", img->entry, img->ls, LS_SIZE);
+}
+
+static PyObject *anergistic_disasm(PyObject *self, PyObject *args)
+{
+	unsigned int pc, instr;
+	char bfr[128];
+
+	(void)self;
+	if (!PyArg_ParseTuple(args, "II", &pc, &instr))
+		return NULL;
+
+	disasm(pc, instr, bfr, sizeof bfr);
+	return PyString_FromString(bfr);
+}
+
+// one entry per opcode (the top 11 bits of an instruction), None or
+// (name, format, pipe, latency, [flags], operands)
+static PyObject *anergistic_opcodes(PyObject *self, PyObject *args)
+{
+	static const char *formats[] = {"rr", "rrr", "ri7", "ri10", "ri16", "ri18", "special", "none"};
+	static const char *pipes[] = {"even", "odd", "none"};
+	static const char *flags[] = {"rdrt", "nort", "nora", "norb", "branch", "load",
+		"store", "call", "hint", "stop", "trap", "signed"};
+	PyObject *list, *op, *names;
+	u32 i, j;
+
+	(void)self;
+	(void)args;
+	list = PyList_New(array_size(instr_tbl));
+	if (list == NULL)
+		return NULL;
+
+	for (i = 0; i < array_size(instr_tbl); i++) {
+		if (instr_tbl[i].name == NULL) {
+			Py_INCREF(Py_None);
+			PyList_SET_ITEM(list, i, Py_None);
+			continue;
+		}
+
+		names = PyList_New(0);
+		for (j = 0; names != NULL && j < array_size(flags); j++) {
+			if ((instr_tbl[i].flags & (1 << j)) == 0)
+				continue;
+			op = PyString_FromString(flags[j]);
+			if (op == NULL || PyList_Append(names, op) < 0) {
+				Py_XDECREF(op);
+				Py_CLEAR(names);
+				break;
+			}
+			Py_DECREF(op);
+		}
+		op = names == NULL ? NULL : Py_BuildValue("(sssiNs)", instr_tbl[i].name,
+			formats[instr_tbl[i].type], pipes[instr_tbl[i].pipe],
+			instr_tbl[i].latency, names, instr_tbl[i].operands);
+		if (op == NULL) {
+			Py_DECREF(list);
+			return NULL;
+		}
+		PyList_SET_ITEM(list, i, op);
+	}
+
+	return list;
+}
+
 void fail(const char *a, ...)
 {
 	char msg[1024];
@@ -116,6 +383,17 @@ void fail(const char *a, ...)
 
 static PyMethodDef AnergisticMethods[] = {
 	{"execute", anergistic_execute, METH_VARARGS, "execute"},
+	{"hook", anergistic_hook, METH_VARARGS, "replace the function at an address with a native builtin"},
+	{"unhook_all", anergistic_unhook_all, METH_NOARGS, "remove all native hooks"},
+	{"coverage_enable", anergistic_coverage_enable, METH_NOARGS, "start recording executed instructions and taken branches"},
+	{"coverage_reset", anergistic_coverage_reset, METH_NOARGS, "clear the recorded coverage"},
+	{"coverage", anergistic_coverage, METH_NOARGS, "return the coverage bitmap and branch edges"},
+	{"snapshot", anergistic_snapshot, METH_VARARGS, "remember local store and registers for reset()"},
+	{"reset", anergistic_reset, METH_VARARGS, "restore the pages written since snapshot() and the registers"},
+	{"dirty", anergistic_dirty, METH_VARARGS, "mark a local store range written from outside execute()"},
+	{"image", anergistic_image, METH_VARARGS, "return the entry point and loaded local store of an ELF, cached by contents"},
+	{"disasm", anergistic_disasm, METH_VARARGS, "disassemble an instruction at an address"},
+	{"opcodes", anergistic_opcodes, METH_NOARGS, "return the name, format, pipeline, latency, flags and operands of every opcode"},
 	{NULL, NULL, 0, NULL}
 };
 
@@ -0,0 +1,121 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "replay.h"
+#include "dirty.h"
+
+int replay_mode = REPLAY_OFF;
+
+static FILE *fp;
+
+static void put(const void *p, u32 len)
+{
+	if (fwrite(p, len, 1, fp) != 1)
+		fail("replay: unable to write record");
+}
+
+static void put32(u32 v)
+{
+	u8 b[4];
+
+	wbe32(b, v);
+	put(b, 4);
+}
+
+static void get(void *p, u32 len)
+{
+	if (fread(p, len, 1, fp) != 1)
+		fail("replay: out of recorded input at pc %05x", ctx->pc);
+}
+
+static u32 get32(void)
+{
+	u8 b[4];
+
+	get(b, 4);
+	return be32(b);
+}
+
+void replay_open(const char *path, int mode)
+{
+	u8 hdr[8];
+
+	fp = fopen(path, mode == REPLAY_RECORD ? "wb" : "rb");
+	if (fp == NULL)
+		fail("replay: unable to open %s", path);
+	replay_mode = mode;
+
+	if (mode == REPLAY_RECORD) {
+		put(REPLAY_MAGIC, 4);
+		put32(REPLAY_VERSION);
+		return;
+	}
+
+	get(hdr, sizeof hdr);
+	if (memcmp(hdr, REPLAY_MAGIC, 4) != 0 || be32(hdr + 4) != REPLAY_VERSION)
+		fail("replay: %s is not a version %d replay file", path, REPLAY_VERSION);
+}
+
+void replay_close(void)
+{
+	if (replay_mode == REPLAY_OFF)
+		return;
+	fclose(fp);
+	replay_mode = REPLAY_OFF;
+}
+
+// records value, or returns the recorded one instead when replaying
+u32 replay_channel(int type, int ch, u32 value)
+{
+	u8 rec[2];
+
+	if (replay_mode == REPLAY_RECORD) {
+		rec[0] = type;
+		rec[1] = ch;
+		put(rec, 2);
+		put32(value);
+		return value;
+	}
+
+	get(rec, 2);
+	if (rec[0] != type || rec[1] != ch)
+		fail("replay: diverged at pc %05x: expected %s ch%d, recorded %s ch%d",
+			ctx->pc, type == REPLAY_RDCH ? "rdch" : "rchcnt", ch,
+			rec[0] == REPLAY_RDCH ? "rdch" :
+			rec[0] == REPLAY_RCHCNT ? "rchcnt" : "dma get", rec[1]);
+	return get32();
+}
+
+// records the data a DMA GET placed at lsa, or copies it there when replaying
+void replay_get(u32 lsa, u32 size)
+{
+	u8 type;
+
+	lsa &= LSLR;
+	if (size > LS_SIZE - lsa)
+		fail("replay: dma get of %08x bytes to %05x overflows the local store", size, lsa);
+
+	if (replay_mode == REPLAY_RECORD) {
+		type = REPLAY_GET;
+		put(&type, 1);
+		put32(lsa);
+		put32(size);
+		put(ctx->ls + lsa, size);
+		return;
+	}
+
+	get(&type, 1);
+	if (type != REPLAY_GET)
+		fail("replay: diverged at pc %05x: expected dma get", ctx->pc);
+	if (get32() != lsa || get32() != size)
+		fail("replay: diverged at pc %05x: dma get to %05x size %08x", ctx->pc, lsa, size);
+	dirty_mark(lsa, size);
+	get(ctx->ls + lsa, size);
+}
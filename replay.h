@@ -0,0 +1,38 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef REPLAY_H__
+#define REPLAY_H__
+
+#include "types.h"
+
+// file layout (big endian):
+//   "ANRP", version, followed by one record per nondeterministic input in
+//   the order the SPU consumed it:
+//     u8 REPLAY_RDCH / REPLAY_RCHCNT, u8 channel, u32 value
+//     u8 REPLAY_GET, u32 lsa, u32 size, size bytes of data
+// spu.py's Recorder writes the same format.
+#define REPLAY_MAGIC	"ANRP"
+#define REPLAY_VERSION	1
+
+enum {
+	REPLAY_RDCH = 1,
+	REPLAY_RCHCNT,
+	REPLAY_GET
+};
+
+enum {
+	REPLAY_OFF,
+	REPLAY_RECORD,
+	REPLAY_PLAY
+};
+
+extern int replay_mode;
+
+void replay_open(const char *path, int mode);
+void replay_close(void);
+u32 replay_channel(int type, int ch, u32 value);
+void replay_get(u32 lsa, u32 size);
+
+#endif
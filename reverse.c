@@ -0,0 +1,191 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "emulate.h"
+#include "dirty.h"
+#include "reverse.h"
+
+struct checkpoint {
+	u64 step;
+	u32 reg[128][4];
+	u32 pc;
+	struct mfc_t mfc;
+	u64 instrs;
+	u32 stop_code;
+	u64 pages;			// pages written since, saved in page[]
+	u8 *page[LS_SIZE / DIRTY_PAGE];
+};
+
+int reverse_enabled = 0;
+// set while going forward to a step again, gdb doesn't stop then
+int reverse_replaying = 0;
+u64 reverse_count = 0;
+// step of the next checkpoint
+u64 reverse_next = 0;
+// pages saved since the newest checkpoint
+u64 reverse_saved = 0;
+
+static u32 interval;
+// oldest first
+static struct checkpoint *cps[REVERSE_MAX_CHECKPOINTS];
+static u32 n_cps;
+static u32 n_pages;
+
+void reverse_init(u32 n)
+{
+	interval = n ? n : REVERSE_INTERVAL;
+	reverse_enabled = 1;
+	reverse_clear();
+}
+
+static void checkpoint_free(struct checkpoint *cp)
+{
+	u32 i;
+
+	for (i = 0; i < array_size(cp->page); i++) {
+		if (cp->page[i] == NULL)
+			continue;
+		free(cp->page[i]);
+		n_pages--;
+	}
+	free(cp);
+}
+
+static void drop_oldest(void)
+{
+	checkpoint_free(cps[0]);
+	n_cps--;
+	memmove(cps, cps + 1, n_cps * sizeof *cps);
+}
+
+void reverse_checkpoint(void)
+{
+	struct checkpoint *cp;
+
+	if (n_cps == REVERSE_MAX_CHECKPOINTS)
+		drop_oldest();
+
+	cp = calloc(1, sizeof *cp);
+	if (cp == NULL) {
+		fail("reverse: unable to allocate a checkpoint");
+		return;
+	}
+	cp->step = reverse_count;
+	memcpy(cp->reg, ctx->reg, sizeof cp->reg);
+	cp->pc = ctx->pc;
+	cp->mfc = ctx->mfc;
+	cp->instrs = ctx->instrs;
+	cp->stop_code = ctx->stop_code;
+	cps[n_cps++] = cp;
+
+	reverse_saved = 0;
+	reverse_next = reverse_count + interval;
+}
+
+// called by dirty_mark() for pages not saved since the newest checkpoint,
+// before they are written
+void reverse_save(u64 pages)
+{
+	struct checkpoint *cp;
+	u32 i;
+
+	// nothing ran yet, there is nothing to go back to
+	if (n_cps == 0)
+		return;
+
+	cp = cps[n_cps - 1];
+	for (i = 0; i < array_size(cp->page); i++) {
+		if ((pages & (1ULL << i)) == 0)
+			continue;
+		cp->page[i] = malloc(DIRTY_PAGE);
+		if (cp->page[i] == NULL) {
+			fail("reverse: unable to save a page");
+			return;
+		}
+		memcpy(cp->page[i], ctx->ls + i * DIRTY_PAGE, DIRTY_PAGE);
+		n_pages++;
+	}
+	cp->pages |= pages;
+	reverse_saved |= pages;
+
+	while (n_pages > REVERSE_MAX_PAGES && n_cps > 1)
+		drop_oldest();
+}
+
+// forgets the history, the next step starts a new one. gdb changing
+// registers or memory makes it useless.
+void reverse_clear(void)
+{
+	while (n_cps > 0)
+		drop_oldest();
+	reverse_saved = 0;
+	reverse_next = reverse_count;
+}
+
+// the oldest step there is a way back to
+u64 reverse_begin(void)
+{
+	return n_cps ? cps[0]->step : reverse_count;
+}
+
+// the step of the newest checkpoint before step
+u64 reverse_prev(u64 step)
+{
+	u32 i;
+
+	for (i = n_cps; i > 0; i--)
+		if (cps[i - 1]->step < step)
+			return cps[i - 1]->step;
+	return reverse_begin();
+}
+
+// brings the context back to where it was before step, which has to be
+// between reverse_begin() and reverse_count
+void reverse_goto(u64 step)
+{
+	struct checkpoint *cp;
+	u32 i, k, page;
+
+	if (n_cps == 0 || step < cps[0]->step || step > reverse_count) {
+		fail("reverse: step %llu is not in the history", step);
+		return;
+	}
+
+	for (k = n_cps - 1; k > 0 && cps[k]->step > step; k--)
+		;
+
+	// newest first, a page written in several intervals ends up as it
+	// was at checkpoint k
+	for (i = n_cps; i > k; i--) {
+		cp = cps[i - 1];
+		for (page = 0; page < array_size(cp->page); page++)
+			if (cp->page[page] != NULL)
+				memcpy(ctx->ls + page * DIRTY_PAGE, cp->page[page], DIRTY_PAGE);
+		if (i - 1 > k)
+			checkpoint_free(cp);
+	}
+	n_cps = k + 1;
+	ctx->ls_gen++;
+
+	cp = cps[k];
+	memcpy(ctx->reg, cp->reg, sizeof ctx->reg);
+	ctx->pc = cp->pc;
+	ctx->mfc = cp->mfc;
+	ctx->instrs = cp->instrs;
+	ctx->stop_code = cp->stop_code;
+	reverse_count = cp->step;
+	reverse_saved = cp->pages;
+	reverse_next = cp->step + interval;
+
+	reverse_replaying = 1;
+	while (reverse_count < step)
+		emulate();
+	reverse_replaying = 0;
+}
@@ -0,0 +1,43 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef REVERSE_H__
+#define REVERSE_H__
+
+#include "types.h"
+
+// with --reverse the context keeps a history that gdb can go back in.
+// every reverse interval steps it takes a checkpoint of the registers, and
+// the first write to a local store page after a checkpoint saves the page
+// as it was. going back to a step undoes the saved pages down to the
+// newest checkpoint before it and runs forward from there.
+//
+// a step is one emulate() that ran an instruction or a hook, reverse_count
+// counts them from the start of the program.
+#define REVERSE_MAX_CHECKPOINTS	4096
+#define REVERSE_MAX_PAGES	16384
+
+extern int reverse_enabled;
+extern int reverse_replaying;
+extern u64 reverse_count;
+extern u64 reverse_next;
+extern u64 reverse_saved;
+
+void reverse_init(u32 interval);
+void reverse_checkpoint(void);
+void reverse_save(u64 pages);
+void reverse_clear(void);
+u64 reverse_begin(void);
+u64 reverse_prev(u64 step);
+void reverse_goto(u64 step);
+
+// called by emulate() before each step
+static inline void reverse_step(void)
+{
+	if (reverse_count == reverse_next)
+		reverse_checkpoint();
+	reverse_count++;
+}
+
+#endif
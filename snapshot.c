@@ -0,0 +1,170 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "gdb.h"
+#include "snapshot.h"
+#include "store.h"
+
+#define SNAPSHOT_MAX_BP	64
+
+const char *snapshot_path = SNAPSHOT_NAME;
+// page store directory snapshots go to instead of plain files, if set
+const char *snapshot_store = NULL;
+// pc to save a snapshot at, never matches unless set
+u32 snapshot_at = ~0;
+
+// one per thread, batch workers save snapshots of their own
+static __thread u8 hdr[SNAPSHOT_LS_OFFSET];
+
+// serializes the machine state into hdr, returns the bytes used
+static u32 encode(u32 pc)
+{
+	struct gdb_bp bp[SNAPSHOT_MAX_BP];
+	u32 mfc[7];
+	u32 n, i, j;
+	u8 *p;
+
+	memset(hdr, 0, sizeof hdr);
+	p = hdr;
+	memcpy(p, SNAPSHOT_MAGIC, 4);
+	wbe32(p + 4, SNAPSHOT_VERSION);
+	wbe32(p + 8, pc);
+	p += 12;
+
+	for (i = 0; i < 128; i++)
+		for (j = 0; j < 4; j++, p += 4)
+			wbe32(p, ctx->reg[i][j]);
+
+	mfc[0] = ctx->mfc.lsa;
+	mfc[1] = ctx->mfc.eah;
+	mfc[2] = ctx->mfc.eal;
+	mfc[3] = ctx->mfc.size;
+	mfc[4] = ctx->mfc.tag_id;
+	mfc[5] = ctx->mfc.tag_mask;
+	mfc[6] = ctx->mfc.tag_stat;
+	for (i = 0; i < array_size(mfc); i++, p += 4)
+		wbe32(p, mfc[i]);
+
+	n = gdb_bp_list(bp, SNAPSHOT_MAX_BP);
+	wbe32(p, n);
+	p += 4;
+	for (i = 0; i < n; i++, p += 12) {
+		wbe32(p, bp[i].type);
+		wbe32(p + 4, bp[i].addr);
+		wbe32(p + 8, bp[i].len);
+	}
+
+	return p - hdr;
+}
+
+static void decode(const char *path)
+{
+	u32 mfc[7];
+	u32 n, i, j;
+	u8 *p;
+
+	if (memcmp(hdr, SNAPSHOT_MAGIC, 4) != 0 || be32(hdr + 4) != SNAPSHOT_VERSION)
+		fail("snapshot: %s is not a version %d snapshot", path, SNAPSHOT_VERSION);
+
+	p = hdr;
+	ctx->pc = be32(p + 8) & LSLR;
+	p += 12;
+
+	for (i = 0; i < 128; i++)
+		for (j = 0; j < 4; j++, p += 4)
+			ctx->reg[i][j] = be32(p);
+
+	for (i = 0; i < array_size(mfc); i++, p += 4)
+		mfc[i] = be32(p);
+	ctx->mfc.lsa = mfc[0];
+	ctx->mfc.eah = mfc[1];
+	ctx->mfc.eal = mfc[2];
+	ctx->mfc.size = mfc[3];
+	ctx->mfc.tag_id = mfc[4];
+	ctx->mfc.tag_mask = mfc[5];
+	ctx->mfc.tag_stat = mfc[6];
+	ctx->ls_gen++;
+
+	n = be32(p);
+	p += 4;
+	if (n > SNAPSHOT_MAX_BP)
+		fail("snapshot: %s has %u breakpoints", path, n);
+	for (i = 0; i < n; i++, p += 12)
+		if (gdb_bp_set(be32(p), be32(p + 4), be32(p + 8)) < 0)
+			printf("snapshot: dropped breakpoint at %05x\n", be32(p + 4));
+}
+
+void snapshot_save(const char *path, u32 pc)
+{
+	FILE *fp;
+	u32 len;
+
+	len = encode(pc);
+	if (snapshot_store != NULL) {
+		store_save(snapshot_store, path, hdr, len, ctx->ls);
+		printf("snapshot: saved pc %05x to %s/%s\n", pc, snapshot_store, path);
+		return;
+	}
+
+	fp = fopen(path, "wb");
+	if (fp == NULL)
+		fail("snapshot: unable to create %s", path);
+	if (fwrite(hdr, sizeof hdr, 1, fp) != 1 ||
+	    fwrite(ctx->ls, LS_SIZE, 1, fp) != 1)
+		fail("snapshot: unable to write %s", path);
+	fclose(fp);
+
+	printf("snapshot: saved pc %05x to %s\n", pc, path);
+}
+
+// replaces ctx->ls with a private mapping of the saved local store.
+// returns 0 if the caller's local store is still in use.
+int snapshot_restore(const char *path)
+{
+	struct stat st;
+	u8 *p;
+	int fd;
+
+	if (snapshot_store != NULL) {
+		memset(hdr, 0, sizeof hdr);
+		fd = store_load(snapshot_store, path, hdr, sizeof hdr);
+		decode(path);
+		return fd;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		fail("snapshot: unable to open %s", path);
+	if (fstat(fd, &st) < 0 || st.st_size < SNAPSHOT_LS_OFFSET + LS_SIZE ||
+	    read(fd, hdr, sizeof hdr) != sizeof hdr)
+		fail("snapshot: %s is truncated", path);
+	decode(path);
+
+#ifdef _WIN32
+	if (read(fd, ctx->ls, LS_SIZE) != LS_SIZE)
+		fail("snapshot: %s is truncated", path);
+	close(fd);
+	return 0;
+#else
+	p = mmap(NULL, LS_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, SNAPSHOT_LS_OFFSET);
+	if (p == MAP_FAILED)
+		fail("snapshot: unable to map the local store of %s", path);
+	close(fd);
+	ctx->ls = p;
+	return 1;
+#endif
+}
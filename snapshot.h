@@ -0,0 +1,28 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef SNAPSHOT_H__
+#define SNAPSHOT_H__
+
+#include "types.h"
+
+// file layout (big endian):
+//   "ANSN", version, pc, register file (128 * 4 words),
+//   MFC state (lsa, eah, eal, size, tag id, tag mask, tag status),
+//   breakpoint count, type/addr/len per breakpoint,
+//   zero padding up to SNAPSHOT_LS_OFFSET, the local store.
+// the local store offset is a multiple of any page size we run on so that
+// restoring maps it copy-on-write instead of reading it.
+#define SNAPSHOT_MAGIC		"ANSN"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_LS_OFFSET	0x10000
+
+extern const char *snapshot_path;
+extern const char *snapshot_store;
+extern u32 snapshot_at;
+
+void snapshot_save(const char *path, u32 pc);
+int snapshot_restore(const char *path);
+
+#endif
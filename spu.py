@@ -106,8 +106,9 @@ class MFC:
 
 class Calltree:
 	"basic calltree. call calltree_init after loading symbols(!), then call calltree_dump at the end."
-	INSN_BI = (0x35000000 >> 21,)
-	INSN_BRSL_BISL = range(0x33000000 >> 21, 0x33800000 >> 21) + [0x35200000 >> 21]
+	# opcodes of bi and of the calls (brsl, bisl), from the instrs table
+	INSN_BI = tuple(i for i, op in enumerate(anergistic.opcodes()) if op and op[0] == "bi")
+	INSN_BRSL_BISL = [i for i, op in enumerate(anergistic.opcodes()) if op and "call" in op[4]]
 	def calltree_init(self, instant = False):
 		# break on bi
 		self.breakpoints_insns.update(self.INSN_BI)
@@ -143,7 +144,35 @@ class Calltree:
 				print "-> %s(%s)" % (self.symbols.get(target), ','.join(["0x%08x" % r for r in res]))
 		self.tree = []
 
-class SPU(MFC, Calltree):
+class Recorder:
+	"records channel reads and DMA GET data for anergistic --replay. call record_init(filename) before running, record_close at the end."
+	REPLAY_RDCH = 1
+	REPLAY_RCHCNT = 2
+	REPLAY_GET = 3
+	def record_init(self, filename):
+		self.record_file = open(filename, "wb")
+		self.record_file.write(struct.pack(">4sI", "ANRP", 1))
+		rdch, rchcnt, dma_get = self.rdch, self.rchcnt, self.dma_get
+		def record_rdch(ch):
+			value = rdch(ch)
+			self.record_file.write(struct.pack(">BBI", self.REPLAY_RDCH, ch, value))
+			return value
+		def record_rchcnt(ch):
+			value = rchcnt(ch)
+			self.record_file.write(struct.pack(">BBI", self.REPLAY_RCHCNT, ch, value))
+			return value
+		def record_dma_get(ea, size):
+			data = dma_get(ea, size)
+			# replay_get() compares the lsa as the local store wraps it
+			self.record_file.write(struct.pack(">BII", self.REPLAY_GET, self.MFC_LSA & 0x3ffff, len(data)))
+			self.record_file.write(data)
+			return data
+		self.rdch, self.rchcnt, self.dma_get = record_rdch, record_rchcnt, record_dma_get
+
+	def record_close(self):
+		self.record_file.close()
+
+class SPU(MFC, Calltree, Recorder):
 	class UnknownStop(Exception):
 		pass
 
@@ -193,7 +222,12 @@ class SPU(MFC, Calltree):
 				self.set_regW(rt, self.rchcnt(ch))
 				self.pc += 4
 			elif opcode & 0xFFE00000 == 0:
-				if self.stop(opcode & 0x3FFF):
+				# stop 0x3ffe (SNAPSHOT_STOP) saves a snapshot file in
+				# anergistic, here it is the one reset() goes back to
+				if opcode & 0x3FFF == 0x3FFE:
+					self.pc += 4
+					self.snapshot()
+				elif self.stop(opcode & 0x3FFF):
 					break
 			else:
 				oldpc = self.pc
@@ -291,6 +325,7 @@ class SPU(MFC, Calltree):
 	def set_ls(self, offset, data):
 		"""Store data in LS at offset"""
 		assert offset + len(data) <= len(self.ls)
+		anergistic.dirty(offset, len(data))
 		self.ls[offset:offset+len(data)] = array.array("c", data)
 
 	def get_ls(self, offset, len):
@@ -303,3 +338,17 @@ class SPU(MFC, Calltree):
 		addr = self.symbols_mangled[addr]
 		self.breakpoints.add(addr)
 		self.hooks[addr] = fnc
+
+	def snapshot(self):
+		"""Remember LS, registers and pc for reset()."""
+		anergistic.snapshot(self.ls, self.registers)
+		self.snapshot_pc = self.pc
+
+	def reset(self):
+		"""Return to the last snapshot(), copying back only the LS pages written since."""
+		anergistic.reset(self.ls, self.registers)
+		self.pc = self.snapshot_pc
+
+	def hook_native(self, symbol, builtin = None):
+		"""Replace a guest function with a native builtin (memcpy, sqrtf, ...) without leaving execute()."""
+		anergistic.hook(self.symbols_mangled[symbol], builtin or symbol)
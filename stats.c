@@ -0,0 +1,161 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "emulate-instrs.h"
+#include "stats.h"
+
+#define MFC_PUT_CMD 0x20
+#define MFC_GET_CMD 0x40
+
+int stats_enabled = 0;
+struct stats_t stats;
+
+static struct timeval start;
+
+static const char *format_names[] = {
+	"rr", "rrr", "ri7", "ri10", "ri16", "ri18", "special", "none"
+};
+
+static const char *channel_ops[] = {
+	"rdch", "wrch", "rchcnt"
+};
+
+void stats_init(void)
+{
+	memset(&stats, 0, sizeof stats);
+	gettimeofday(&start, NULL);
+	stats_enabled = 1;
+}
+
+void stats_stop(u32 code)
+{
+	if (stats_enabled)
+		stats.stops[code & 0x3fff]++;
+}
+
+void stats_dma(u32 cmd, u32 size)
+{
+	if (!stats_enabled)
+		return;
+
+	stats.dma_cmds++;
+	if ((cmd & ~3) == MFC_GET_CMD)
+		stats.dma_get += size;
+	else if ((cmd & ~3) == MFC_PUT_CMD)
+		stats.dma_put += size;
+}
+
+// instructions sharing a handler are reported under a single name
+static void stats_dump_opcodes(FILE *fp)
+{
+	const char *sep = "";
+	u32 i, j;
+	u64 n;
+
+	fprintf(fp, "\t\"opcodes\": {");
+	for (i = 0; i < array_size(instr_tbl); i++) {
+		if (instr_tbl[i].name == NULL)
+			continue;
+
+		for (j = 0; j < i; j++)
+			if (instr_tbl[j].ptr == instr_tbl[i].ptr)
+				break;
+		if (j != i)
+			continue;
+
+		n = 0;
+		for (j = i; j < array_size(instr_tbl); j++)
+			if (instr_tbl[j].ptr == instr_tbl[i].ptr)
+				n += stats.instrs[j];
+
+		if (n == 0)
+			continue;
+		fprintf(fp, "%s\n\t\t\"%s\": %llu", sep, instr_tbl[i].name, n);
+		sep = ",";
+	}
+	fprintf(fp, "\n\t},\n");
+}
+
+void stats_dump(const char *path)
+{
+	struct timeval now;
+	u64 formats[array_size(format_names)];
+	u64 total;
+	double secs;
+	const char *sep;
+	FILE *fp;
+	u32 i, j;
+
+	if (!stats_enabled)
+		return;
+
+	gettimeofday(&now, NULL);
+	secs = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+
+	memset(formats, 0, sizeof formats);
+	total = 0;
+	for (i = 0; i < array_size(instr_tbl); i++) {
+		formats[instr_tbl[i].type] += stats.instrs[i];
+		total += stats.instrs[i];
+	}
+
+	if (strcmp(path, "-") == 0)
+		fp = stdout;
+	else
+		fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror("stats: unable to open output");
+		return;
+	}
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"instructions\": %llu,\n", total);
+	fprintf(fp, "\t\"hooks\": %llu,\n", stats.hooks);
+	fprintf(fp, "\t\"host_seconds\": %.6f,\n", secs);
+	fprintf(fp, "\t\"mips\": %.3f,\n", secs > 0 ? total / secs / 1e6 : 0.0);
+
+	fprintf(fp, "\t\"formats\": {");
+	for (i = 0; i < array_size(format_names); i++)
+		fprintf(fp, "%s\n\t\t\"%s\": %llu", i ? "," : "", format_names[i], formats[i]);
+	fprintf(fp, "\n\t},\n");
+
+	stats_dump_opcodes(fp);
+
+	fprintf(fp, "\t\"channels\": {");
+	for (i = 0; i < STATS_CH_OPS; i++) {
+		fprintf(fp, "%s\n\t\t\"%s\": {", i ? "," : "", channel_ops[i]);
+		sep = "";
+		for (j = 0; j < 128; j++) {
+			if (stats.channel[i][j] == 0)
+				continue;
+			fprintf(fp, "%s\"%u\": %llu", sep, j, stats.channel[i][j]);
+			sep = ", ";
+		}
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "\n\t},\n");
+
+	fprintf(fp, "\t\"dma\": {\"commands\": %llu, \"get_bytes\": %llu, \"put_bytes\": %llu},\n",
+			stats.dma_cmds, stats.dma_get, stats.dma_put);
+
+	fprintf(fp, "\t\"stops\": {");
+	sep = "";
+	for (i = 0; i < array_size(stats.stops); i++) {
+		if (stats.stops[i] == 0)
+			continue;
+		fprintf(fp, "%s\"0x%04x\": %llu", sep, i, stats.stops[i]);
+		sep = ", ";
+	}
+	fprintf(fp, "}\n}\n");
+
+	if (fp != stdout)
+		fclose(fp);
+}
@@ -0,0 +1,41 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef STATS_H__
+#define STATS_H__
+
+#include "types.h"
+
+enum {
+	STATS_RDCH,
+	STATS_WRCH,
+	STATS_RCHCNT,
+	STATS_CH_OPS
+};
+
+struct stats_t {
+	u64 instrs[2048];
+	u64 channel[STATS_CH_OPS][128];
+	u64 dma_cmds;
+	u64 dma_get;
+	u64 dma_put;
+	u64 stops[0x4000];
+	u64 hooks;
+};
+
+extern int stats_enabled;
+extern struct stats_t stats;
+
+void stats_init(void);
+void stats_stop(u32 code);
+void stats_dma(u32 cmd, u32 size);
+void stats_dump(const char *path);
+
+static inline void stats_channel(int op, int ch)
+{
+	if (stats_enabled)
+		stats.channel[op][ch & 127]++;
+}
+
+#endif
@@ -0,0 +1,267 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "store.h"
+
+#define STORE_PAGES	(LS_SIZE / STORE_PAGE)
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+struct store_entry {
+	u64 hash;
+	u32 page;
+	u32 used;
+};
+
+// hash -> pack page of the currently open store, open addressing
+static char *open_dir;
+static int pack_fd = -1;
+static FILE *index_fp;
+static u32 pack_pages;
+static struct store_entry *index_tbl;
+static u32 index_size;
+static u32 index_used;
+
+static u64 hash_page(const u8 *p)
+{
+	u64 h = 0xcbf29ce484222325ULL;
+	u32 i;
+
+	for (i = 0; i < STORE_PAGE; i += 4) {
+		h ^= be32((u8 *)p + i);
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static int zero_page(const u8 *p)
+{
+	u32 i;
+
+	for (i = 0; i < STORE_PAGE; i++)
+		if (p[i] != 0)
+			return 0;
+	return 1;
+}
+
+static void path_in(char *bfr, u32 size, const char *dir, const char *name)
+{
+	if ((u32)snprintf(bfr, size, "%s/%s", dir, name) >= size)
+		fail("store: path too long: %s/%s", dir, name);
+}
+
+static void index_insert(u64 hash, u32 page)
+{
+	struct store_entry *old;
+	u32 old_size, i, j;
+
+	if (2 * (index_used + 1) > index_size) {
+		old = index_tbl;
+		old_size = index_size;
+		index_size = index_size ? 2 * index_size : 1024;
+		index_tbl = calloc(index_size, sizeof *index_tbl);
+		if (index_tbl == NULL)
+			fail("store: unable to grow the page index");
+		index_used = 0;
+		for (i = 0; i < old_size; i++)
+			if (old[i].used)
+				index_insert(old[i].hash, old[i].page);
+		free(old);
+	}
+
+	for (j = hash & (index_size - 1); index_tbl[j].used; j = (j + 1) & (index_size - 1))
+		;
+	index_tbl[j].hash = hash;
+	index_tbl[j].page = page;
+	index_tbl[j].used = 1;
+	index_used++;
+}
+
+static void read_page(u32 page, u8 *p)
+{
+	if (lseek(pack_fd, (off_t)page * STORE_PAGE, SEEK_SET) < 0 ||
+	    read(pack_fd, p, STORE_PAGE) != STORE_PAGE)
+		fail("store: unable to read page %u of %s", page, STORE_PACK);
+}
+
+static void store_open(const char *dir)
+{
+	char path[1024];
+	u8 rec[12];
+	struct stat st;
+
+	if (open_dir != NULL && strcmp(open_dir, dir) == 0)
+		return;
+
+	if (open_dir != NULL) {
+		close(pack_fd);
+		fclose(index_fp);
+		free(open_dir);
+		free(index_tbl);
+		index_tbl = NULL;
+		index_size = index_used = 0;
+	}
+
+#ifdef _WIN32
+	mkdir(dir);
+#else
+	mkdir(dir, 0777);
+#endif
+	path_in(path, sizeof path, dir, STORE_PACK);
+	pack_fd = open(path, O_RDWR | O_CREAT | O_BINARY, 0666);
+	if (pack_fd < 0 || fstat(pack_fd, &st) < 0)
+		fail("store: unable to open %s", path);
+	pack_pages = st.st_size / STORE_PAGE;
+
+	path_in(path, sizeof path, dir, STORE_INDEX);
+	index_fp = fopen(path, "a+b");
+	if (index_fp == NULL)
+		fail("store: unable to open %s", path);
+	rewind(index_fp);
+	while (fread(rec, sizeof rec, 1, index_fp) == 1)
+		if (be32(rec + 8) < pack_pages)
+			index_insert(be64(rec), be32(rec + 8));
+
+	open_dir = strdup(dir);
+}
+
+// returns the pack page holding p, appending it if it is new
+static u32 store_page(const u8 *p)
+{
+	static u8 cmp[STORE_PAGE];
+	u8 rec[12];
+	u64 hash;
+	u32 j;
+
+	if (zero_page(p))
+		return STORE_ZERO;
+
+	hash = hash_page(p);
+	for (j = hash & (index_size - 1); index_size && index_tbl[j].used; j = (j + 1) & (index_size - 1)) {
+		if (index_tbl[j].hash != hash)
+			continue;
+		read_page(index_tbl[j].page, cmp);
+		if (memcmp(cmp, p, STORE_PAGE) == 0)
+			return index_tbl[j].page;
+	}
+
+	if (lseek(pack_fd, (off_t)pack_pages * STORE_PAGE, SEEK_SET) < 0 ||
+	    write(pack_fd, p, STORE_PAGE) != STORE_PAGE)
+		fail("store: unable to append to %s", STORE_PACK);
+
+	wbe64(rec, hash);
+	wbe32(rec + 8, pack_pages);
+	if (fwrite(rec, sizeof rec, 1, index_fp) != 1 || fflush(index_fp) != 0)
+		fail("store: unable to append to %s", STORE_INDEX);
+
+	index_insert(hash, pack_pages);
+	return pack_pages++;
+}
+
+void store_save(const char *dir, const char *name, const u8 *hdr, u32 hdr_len, const u8 *ls)
+{
+	char path[1024];
+	u8 pages[4 * STORE_PAGES];
+	u8 head[12];
+	u32 i, before;
+	FILE *fp;
+
+	store_open(dir);
+	before = pack_pages;
+	for (i = 0; i < STORE_PAGES; i++)
+		wbe32(pages + 4 * i, store_page(ls + i * STORE_PAGE));
+
+	memcpy(head, STORE_MAGIC, 4);
+	wbe32(head + 4, STORE_VERSION);
+	wbe32(head + 8, hdr_len);
+
+	path_in(path, sizeof path, dir, name);
+	fp = fopen(path, "wb");
+	if (fp == NULL)
+		fail("store: unable to create %s", path);
+	if (fwrite(head, sizeof head, 1, fp) != 1 ||
+	    fwrite(hdr, hdr_len, 1, fp) != 1 ||
+	    fwrite(pages, sizeof pages, 1, fp) != 1)
+		fail("store: unable to write %s", path);
+	fclose(fp);
+
+	printf("store: %u of %u pages were new\n", pack_pages - before, STORE_PAGES);
+}
+
+// reads the snapshot header of a manifest into hdr and points ctx->ls at
+// its pages. returns 0 if the caller's local store is still in use.
+int store_load(const char *dir, const char *name, u8 *hdr, u32 hdr_max)
+{
+	char path[1024];
+	u8 pages[4 * STORE_PAGES];
+	u8 head[12];
+	u32 i, page;
+	FILE *fp;
+	u8 *ls;
+
+	store_open(dir);
+
+	path_in(path, sizeof path, dir, name);
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		fail("store: unable to open %s", path);
+	if (fread(head, sizeof head, 1, fp) != 1 ||
+	    memcmp(head, STORE_MAGIC, 4) != 0 || be32(head + 4) != STORE_VERSION)
+		fail("store: %s is not a version %d manifest", path, STORE_VERSION);
+	if (be32(head + 8) > hdr_max ||
+	    fread(hdr, be32(head + 8), 1, fp) != 1 ||
+	    fread(pages, sizeof pages, 1, fp) != 1)
+		fail("store: %s is truncated", path);
+	fclose(fp);
+
+	for (i = 0; i < STORE_PAGES; i++) {
+		page = be32(pages + 4 * i);
+		if (page != STORE_ZERO && page >= pack_pages)
+			fail("store: %s refers to missing page %u", path, page);
+	}
+
+#ifndef _WIN32
+	// private mappings of the pack share identical pages between all
+	// restored snapshots until they are written
+	if (sysconf(_SC_PAGESIZE) == STORE_PAGE) {
+		ls = mmap(NULL, LS_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ls == MAP_FAILED)
+			fail("store: unable to map a local store");
+		for (i = 0; i < STORE_PAGES; i++) {
+			page = be32(pages + 4 * i);
+			if (page == STORE_ZERO)
+				continue;
+			if (mmap(ls + i * STORE_PAGE, STORE_PAGE, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_FIXED, pack_fd, (off_t)page * STORE_PAGE) == MAP_FAILED)
+				fail("store: unable to map page %u", page);
+		}
+		ctx->ls = ls;
+		return 1;
+	}
+#endif
+
+	for (i = 0; i < STORE_PAGES; i++) {
+		page = be32(pages + 4 * i);
+		if (page == STORE_ZERO)
+			memset(ctx->ls + i * STORE_PAGE, 0, STORE_PAGE);
+		else
+			read_page(page, ctx->ls + i * STORE_PAGE);
+	}
+	return 0;
+}
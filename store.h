@@ -0,0 +1,27 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef STORE_H__
+#define STORE_H__
+
+#include "types.h"
+
+// a page store directory holds
+//   pages.pack	every distinct 4KB local store page once, in the order first seen
+//   pages.idx	hash (u64) and pack page number (u32) of each page in pages.pack
+//   <name>	one manifest per snapshot (big endian):
+//		"ANSM", version, header length, snapshot header,
+//		pack page number for each of the 64 local store pages
+// all-zero pages are not stored, their page number is STORE_ZERO.
+#define STORE_MAGIC	"ANSM"
+#define STORE_VERSION	1
+#define STORE_PACK	"pages.pack"
+#define STORE_INDEX	"pages.idx"
+#define STORE_PAGE	4096
+#define STORE_ZERO	0xffffffff
+
+void store_save(const char *dir, const char *name, const u8 *hdr, u32 hdr_len, const u8 *ls);
+int store_load(const char *dir, const char *name, u8 *hdr, u32 hdr_max);
+
+#endif
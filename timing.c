@@ -0,0 +1,318 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+// cycle-approximate model of the SPU pipeline. every retired instruction is
+// issued to its even or odd pipeline no earlier than its source registers
+// become available. an even instruction at a doubleword aligned address
+// dual-issues with the odd instruction following it. taken branches pay a
+// refill penalty unless a matching hint was issued early enough.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "elf.h"
+#include "emulate-instrs.h"
+#include "timing.h"
+
+#define BRANCH_PENALTY		18
+#define HINT_DISTANCE		11
+#define REPORT_BLOCKS		32
+
+int timing_enabled = 0;
+
+static u64 ready[128];
+static u64 cycle;
+static u64 fetch;
+static u64 instrs;
+static u64 dual;
+static u64 stalls;
+static u64 penalties;
+static u64 mispredicts;
+
+static u32 prev_pc;
+static enum spu_pipe prev_pipe;
+static int new_block;
+static u32 block;
+
+static struct {
+	int valid;
+	u32 branch;
+	u32 target;
+	u64 cycle;
+} hint;
+
+static u64 *block_cycles;
+static u64 *block_count;
+
+#define bits(start, end) ((instr >> (31 - end)) & ((1 << (end - start + 1)) - 1))
+
+void timing_init(void)
+{
+	memset(ready, 0, sizeof ready);
+	cycle = fetch = instrs = dual = stalls = penalties = mispredicts = 0;
+	prev_pc = ~0;
+	prev_pipe = SPU_PIPE_NONE;
+	new_block = 1;
+	hint.valid = 0;
+
+	block_cycles = calloc(LS_SIZE / 4, sizeof *block_cycles);
+	block_count = calloc(LS_SIZE / 4, sizeof *block_count);
+	if (block_cycles == NULL || block_count == NULL)
+		fail("timing: unable to allocate block counters");
+
+	timing_enabled = 1;
+}
+
+static void timing_hint(u32 pc, u32 instr, u64 issue)
+{
+	u32 ro;
+
+	if (instr_tbl[bits(0, 10)].type == SPU_INSTR_SPECIAL) {
+		// hbr: target taken from ra
+		ro = se((bits(16, 17) << 7) | bits(25, 31), 9) << 2;
+		hint.target = ctx->reg[bits(18, 24)][0] & LSLR & ~3;
+	} else {
+		ro = se((bits(7, 8) << 7) | bits(25, 31), 9) << 2;
+		if (bits(0, 6) == 0x08)
+			hint.target = bits(9, 24) << 2;
+		else
+			hint.target = pc + (se16(bits(9, 24)) << 2);
+		hint.target &= LSLR;
+	}
+
+	hint.branch = (pc + ro) & LSLR;
+	hint.cycle = issue;
+	hint.valid = 1;
+}
+
+static void timing_branch(u32 pc, u32 next, u64 issue)
+{
+	int hinted, taken;
+	u64 penalty = 0;
+
+	taken = next != ((pc + 4) & LSLR);
+	hinted = hint.valid && hint.branch == pc;
+
+	if (hinted && hint.target == next) {
+		if (issue - hint.cycle < HINT_DISTANCE)
+			penalty = HINT_DISTANCE - (issue - hint.cycle);
+	} else if (taken || hinted) {
+		penalty = BRANCH_PENALTY;
+		mispredicts++;
+	}
+
+	penalties += penalty;
+	fetch = issue + 1 + penalty;
+}
+
+void timing_retire(u32 pc, u32 instr, u32 op)
+{
+	u32 flags = instr_tbl[op].flags;
+	enum spu_pipe pipe = instr_tbl[op].pipe;
+	u32 src[4];
+	u32 n = 0;
+	u32 i;
+	u32 rt = bits(25, 31);
+	u32 next = ctx->pc;
+	u64 earliest, issue;
+
+	switch (instr_tbl[op].type) {
+		case SPU_INSTR_RRR:
+			rt = bits(4, 10);
+			src[n++] = bits(11, 17);
+			src[n++] = bits(18, 24);
+			src[n++] = bits(25, 31);
+			break;
+		case SPU_INSTR_RR:
+			if (!(flags & INSTR_NO_RB))
+				src[n++] = bits(11, 17);
+			// fall through
+		case SPU_INSTR_RI7:
+		case SPU_INSTR_RI10:
+			if (!(flags & INSTR_NO_RA))
+				src[n++] = bits(18, 24);
+			break;
+		case SPU_INSTR_SPECIAL:
+			flags |= INSTR_NO_RT;
+			break;
+		default:
+			break;
+	}
+	if (flags & INSTR_READS_RT)
+		src[n++] = rt;
+
+	earliest = 0;
+	for (i = 0; i < n; i++)
+		if (ready[src[i]] > earliest)
+			earliest = ready[src[i]];
+
+	// dual issue with the previous even instruction
+	if (instrs != 0 && pipe == SPU_PIPE_ODD && prev_pipe == SPU_PIPE_EVEN &&
+	    pc == prev_pc + 4 && (prev_pc & 7) == 0 && earliest <= cycle) {
+		issue = cycle;
+		dual++;
+	} else {
+		issue = instrs == 0 ? 0 : cycle + 1;
+		if (fetch > issue)
+			issue = fetch;
+		if (earliest > issue) {
+			stalls += earliest - issue;
+			issue = earliest;
+		}
+	}
+
+	if (new_block) {
+		block = pc >> 2;
+		block_count[block]++;
+		new_block = 0;
+	}
+	block_cycles[block] += issue - cycle + (instrs == 0);
+
+	if (!(flags & INSTR_NO_RT))
+		ready[rt] = issue + instr_tbl[op].latency;
+
+	if (flags & INSTR_HINT)
+		timing_hint(pc, instr, issue);
+
+	if ((flags & INSTR_BRANCH) || next != ((pc + 4) & LSLR)) {
+		timing_branch(pc, next, issue);
+		new_block = 1;
+		// nothing dual-issues across a branch
+		pipe = SPU_PIPE_NONE;
+	}
+
+	prev_pc = pc;
+	prev_pipe = pipe;
+	cycle = issue;
+	instrs++;
+}
+
+// issue cycle of the last retired instruction
+u64 timing_cycle(void)
+{
+	return cycle;
+}
+
+struct func_cycles {
+	const struct elf_sym *sym;
+	u64 cycles;
+};
+
+static int func_cmp(const void *a, const void *b)
+{
+	const struct func_cycles *x = a;
+	const struct func_cycles *y = b;
+
+	if (x->cycles != y->cycles)
+		return x->cycles > y->cycles ? -1 : 1;
+	return 0;
+}
+
+static void timing_report_functions(FILE *fp, u64 total)
+{
+	struct func_cycles *funcs;
+	const struct elf_sym *s;
+	u32 n_funcs = 0;
+	u32 i, j;
+
+	funcs = calloc(LS_SIZE / 4, sizeof *funcs);
+	if (funcs == NULL)
+		return;
+
+	for (i = 0; i < LS_SIZE / 4; i++) {
+		if (block_cycles[i] == 0)
+			continue;
+
+		s = elf_sym_by_addr(i << 2);
+		for (j = 0; j < n_funcs; j++)
+			if (funcs[j].sym == s)
+				break;
+		if (j == n_funcs)
+			funcs[n_funcs++].sym = s;
+		funcs[j].cycles += block_cycles[i];
+	}
+
+	qsort(funcs, n_funcs, sizeof *funcs, func_cmp);
+
+	fprintf(fp, "\n%12s %7s  %s\n", "cycles", "share", "function");
+	for (i = 0; i < n_funcs; i++)
+		fprintf(fp, "%12llu %6.2f%%  %s\n", funcs[i].cycles,
+				100.0 * funcs[i].cycles / total,
+				funcs[i].sym ? funcs[i].sym->name : "??");
+
+	free(funcs);
+}
+
+static void timing_report_blocks(FILE *fp, u64 total)
+{
+	const struct elf_sym *s;
+	u32 shown[REPORT_BLOCKS];
+	u32 n, i, j, best;
+
+	fprintf(fp, "\n%8s %10s %12s %7s  %s\n", "block", "count", "cycles", "share", "function");
+	for (n = 0; n < REPORT_BLOCKS; n++) {
+		best = LS_SIZE / 4;
+		for (i = 0; i < LS_SIZE / 4; i++) {
+			if (block_cycles[i] == 0)
+				continue;
+			for (j = 0; j < n; j++)
+				if (shown[j] == i)
+					break;
+			if (j != n)
+				continue;
+			if (best == LS_SIZE / 4 || block_cycles[i] > block_cycles[best])
+				best = i;
+		}
+		if (best == LS_SIZE / 4)
+			break;
+		shown[n] = best;
+
+		s = elf_sym_by_addr(best << 2);
+		fprintf(fp, "%08x %10llu %12llu %6.2f%%  ", best << 2,
+				block_count[best], block_cycles[best],
+				100.0 * block_cycles[best] / total);
+		if (s != NULL)
+			fprintf(fp, "%s+0x%x\n", s->name, (best << 2) - s->addr);
+		else
+			fprintf(fp, "??\n");
+	}
+}
+
+void timing_report(const char *path)
+{
+	u64 total;
+	FILE *fp;
+
+	if (!timing_enabled)
+		return;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdout;
+	else
+		fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror("timing: unable to open output");
+		return;
+	}
+
+	total = instrs ? cycle + 1 : 0;
+	fprintf(fp, "cycles:            %llu\n", total);
+	fprintf(fp, "instructions:      %llu\n", instrs);
+	fprintf(fp, "cpi:               %.3f\n", instrs ? (double)total / instrs : 0.0);
+	fprintf(fp, "dual issued:       %llu\n", dual);
+	fprintf(fp, "dependency stalls: %llu\n", stalls);
+	fprintf(fp, "branch penalties:  %llu (%llu mispredicted)\n", penalties, mispredicts);
+
+	if (total != 0) {
+		timing_report_functions(fp, total);
+		timing_report_blocks(fp, total);
+	}
+
+	if (fp != stdout)
+		fclose(fp);
+}
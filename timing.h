@@ -0,0 +1,17 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef TIMING_H__
+#define TIMING_H__
+
+#include "types.h"
+
+extern int timing_enabled;
+
+void timing_init(void);
+void timing_retire(u32 pc, u32 instr, u32 op);
+void timing_report(const char *path);
+u64 timing_cycle(void);
+
+#endif
@@ -0,0 +1,183 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+// expands a trace written by anergistic --trace into the DEBUG_TRACE text
+// format, optionally limited to a pc range.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "config.h"
+#include "emulate.h"
+#include "trace.h"
+
+struct record {
+	u32 pc;
+	u32 instr;
+	u32 r1;
+};
+
+static FILE *fp;
+static u8 types[2048];
+static u32 reg[128][4];
+static u32 start = 0, end = ~0;
+
+static void fail_decode(const char *msg)
+{
+	fprintf(stderr, "trace-decode: %s\n", msg);
+	exit(1);
+}
+
+static int get8(u8 *v)
+{
+	int c = getc(fp);
+
+	if (c == EOF)
+		return 0;
+	*v = c;
+	return 1;
+}
+
+static u32 get32(void)
+{
+	u8 b[4];
+
+	if (fread(b, sizeof b, 1, fp) != 1)
+		fail_decode("truncated trace");
+	return be32(b);
+}
+
+static void print_reg(const char *name, u32 r)
+{
+	printf("%s:\t%08x %08x %08x %08x ", name, reg[r][0], reg[r][1], reg[r][2], reg[r][3]);
+}
+
+// pc_after is the pc as the instruction left it, like DEBUG_TRACE shows it
+static void print_record(struct record *r, u32 pc_after)
+{
+	u32 instr = r->instr;
+	u32 type = types[instr >> 21];
+
+	if (r->pc < start || r->pc >= end)
+		return;
+
+	printf("%05x: %08x (r1=%08x) ", r->pc, instr, r->r1);
+	printf("%05x: ", pc_after);
+	switch (type) {
+		case SPU_INSTR_RRR:
+			print_reg("rt", (instr >> 21) & 0x7f);
+			print_reg("ra", (instr >> 7) & 0x7f);
+			print_reg("rb", (instr >> 14) & 0x7f);
+			print_reg("rc", instr & 0x7f);
+			break;
+		case SPU_INSTR_RR:
+			print_reg("rt", instr & 0x7f);
+			print_reg("ra", (instr >> 7) & 0x7f);
+			print_reg("rb", (instr >> 14) & 0x7f);
+			break;
+		case SPU_INSTR_RI7:
+		case SPU_INSTR_RI10:
+			print_reg("rt", instr & 0x7f);
+			print_reg("ra", (instr >> 7) & 0x7f);
+			break;
+		case SPU_INSTR_SPECIAL:
+			break;
+		default:
+			print_reg("rt", instr & 0x7f);
+			break;
+	}
+	printf("\n");
+}
+
+static void usage(void)
+{
+	printf("usage: trace-decode [-s start] [-e end] " TRACE_NAME "\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct record cur, prev;
+	int have_prev = 0;
+	u8 hdr[4];
+	u8 flags, b, rt;
+	u32 pc, zz, shift;
+	u32 i, j;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:e:")) != -1) {
+		switch (c) {
+			case 's':
+				start = strtoul(optarg, NULL, 16);
+				break;
+			case 'e':
+				end = strtoul(optarg, NULL, 16);
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if (optind != argc - 1)
+		usage();
+
+	fp = fopen(argv[optind], "rb");
+	if (fp == NULL)
+		fail_decode("unable to open trace");
+
+	if (fread(hdr, sizeof hdr, 1, fp) != 1 || memcmp(hdr, TRACE_MAGIC, 4) != 0)
+		fail_decode("not a trace file");
+	if (get32() != TRACE_VERSION)
+		fail_decode("unsupported trace version");
+
+	pc = get32() - 4;
+	if (fread(types, sizeof types, 1, fp) != 1)
+		fail_decode("truncated trace");
+	for (i = 0; i < 128; i++)
+		for (j = 0; j < 4; j++)
+			reg[i][j] = get32();
+
+	while (get8(&flags)) {
+		if (flags & TRACE_PC) {
+			zz = 0;
+			shift = 0;
+			do {
+				if (!get8(&b))
+					fail_decode("truncated trace");
+				zz |= (b & 0x7f) << shift;
+				shift += 7;
+			} while (b & 0x80);
+			pc += ((zz >> 1) ^ -(zz & 1)) << 2;
+		}
+		pc = (pc + 4) & LSLR;
+
+		cur.pc = pc;
+		cur.instr = get32();
+		cur.r1 = reg[1][0];
+
+		// the previous instruction is complete once we know where it went
+		if (have_prev)
+			print_record(&prev, (cur.pc - 4) & LSLR);
+
+		if (flags & 0xf0) {
+			if (!get8(&rt) || rt > 127)
+				fail_decode("corrupt register delta");
+			for (i = 0; i < 4; i++)
+				if (flags & (0x80 >> i))
+					reg[rt][i] = get32();
+		}
+
+		prev = cur;
+		have_prev = 1;
+	}
+
+	if (have_prev)
+		print_record(&prev, prev.pc);
+
+	fclose(fp);
+	return 0;
+}
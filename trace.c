@@ -0,0 +1,179 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "config.h"
+#include "types.h"
+#include "main.h"
+#include "emulate-instrs.h"
+#include "trace.h"
+
+#define TRACE_RING	(1024 * 1024)
+#define TRACE_RECORD	32
+#define TRACE_WINDOW	(16 * 1024 * 1024)
+
+int trace_enabled = 0;
+
+static u8 ring[TRACE_RING];
+static u32 ring_len;
+
+static u32 last_pc;
+static u32 saved_rt;
+static u32 saved[4];
+
+#ifdef _WIN32
+static FILE *fp;
+#else
+static int fd = -1;
+static u8 *map;
+static u64 map_off;
+static u32 map_pos;
+
+static void trace_map(void)
+{
+	if (ftruncate(fd, map_off + TRACE_WINDOW) < 0)
+		fail("trace: unable to grow trace file");
+
+	map = mmap(NULL, TRACE_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_off);
+	if (map == MAP_FAILED)
+		fail("trace: unable to map trace file");
+	map_pos = 0;
+}
+#endif
+
+static void trace_flush(void)
+{
+#ifdef _WIN32
+	fwrite(ring, ring_len, 1, fp);
+#else
+	u32 done, n;
+
+	for (done = 0; done < ring_len; done += n) {
+		if (map_pos == TRACE_WINDOW) {
+			munmap(map, TRACE_WINDOW);
+			map_off += TRACE_WINDOW;
+			trace_map();
+		}
+
+		n = ring_len - done;
+		if (n > TRACE_WINDOW - map_pos)
+			n = TRACE_WINDOW - map_pos;
+		memcpy(map + map_pos, ring + done, n);
+		map_pos += n;
+	}
+#endif
+	ring_len = 0;
+}
+
+static void put32(u32 v)
+{
+	wbe32(ring + ring_len, v);
+	ring_len += 4;
+}
+
+void trace_open(const char *path)
+{
+	u32 i, j;
+
+#ifdef _WIN32
+	fp = fopen(path, "wb");
+	if (fp == NULL)
+		fail("trace: unable to create %s", path);
+#else
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		fail("trace: unable to create %s", path);
+	map_off = 0;
+	trace_map();
+#endif
+
+	ring_len = 0;
+	memcpy(ring, TRACE_MAGIC, 4);
+	ring_len += 4;
+	put32(TRACE_VERSION);
+	put32(ctx->pc);
+	for (i = 0; i < array_size(instr_tbl); i++)
+		ring[ring_len++] = instr_tbl[i].type;
+	for (i = 0; i < 128; i++)
+		for (j = 0; j < 4; j++)
+			put32(ctx->reg[i][j]);
+
+	last_pc = ctx->pc - 4;
+	trace_enabled = 1;
+}
+
+void trace_close(void)
+{
+	if (!trace_enabled)
+		return;
+
+	trace_flush();
+#ifdef _WIN32
+	fclose(fp);
+#else
+	munmap(map, TRACE_WINDOW);
+	if (ftruncate(fd, map_off + map_pos) < 0)
+		perror("trace: unable to truncate trace file");
+	close(fd);
+	fd = -1;
+#endif
+	trace_enabled = 0;
+}
+
+// remembers the target register before the instruction executes
+void trace_before(u32 rt)
+{
+	saved_rt = rt;
+	memcpy(saved, ctx->reg[rt], sizeof saved);
+}
+
+void trace_after(u32 pc, u32 instr)
+{
+	u32 flags = 0;
+	u32 mask = 0;
+	u32 delta, zz;
+	u32 i;
+	u8 *f;
+
+	if (ring_len > TRACE_RING - TRACE_RECORD)
+		trace_flush();
+
+	for (i = 0; i < 4; i++)
+		if (ctx->reg[saved_rt][i] != saved[i])
+			mask |= 8 >> i;
+
+	f = ring + ring_len++;
+
+	delta = (pc - last_pc - 4) & LSLR;
+	if (delta != 0) {
+		flags |= TRACE_PC;
+		// shortest way around the local store, zigzag encoded
+		zz = (s32)(delta << (32 - 18)) >> (32 - 18 + 2);
+		zz = (zz << 1) ^ ((s32)zz >> 31);
+		while (zz >= 0x80) {
+			ring[ring_len++] = zz | 0x80;
+			zz >>= 7;
+		}
+		ring[ring_len++] = zz;
+	}
+	last_pc = pc;
+
+	put32(instr);
+
+	if (mask != 0) {
+		ring[ring_len++] = saved_rt;
+		for (i = 0; i < 4; i++)
+			if (mask & (8 >> i))
+				put32(ctx->reg[saved_rt][i]);
+	}
+
+	*f = flags | (mask << 4);
+}
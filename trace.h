@@ -0,0 +1,34 @@
+// Copyright 2010 fail0verflow <master@fail0verflow.com>
+// Licensed under the terms of the GNU GPL, version 2
+// http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+
+#ifndef TRACE_H__
+#define TRACE_H__
+
+#include "types.h"
+
+// file layout (big endian):
+//   "ANTR", version, start pc, instruction format per opcode (2048 bytes),
+//   initial register file (128 * 16 bytes), followed by one record per
+//   retired instruction:
+//     u8 flags	TRACE_PC: a pc delta follows, bits 4-7: changed words of rt
+//     pc delta	zigzag varint of (pc - (last pc + 4)) / 4
+//     u32 instr
+//     u8 rt, u32 word for each changed word	if any word changed
+//
+// a hooked function (see hook.h) runs natively and retires nothing, so
+// it has no record. the record of the call is followed by that of the
+// return address, and whatever the hook wrote to the registers or the
+// local store is not in the trace.
+#define TRACE_MAGIC	"ANTR"
+#define TRACE_VERSION	1
+#define TRACE_PC	0x01
+
+extern int trace_enabled;
+
+void trace_open(const char *path);
+void trace_close(void);
+void trace_before(u32 rt);
+void trace_after(u32 pc, u32 instr);
+
+#endif